@@ -0,0 +1,144 @@
+/* ********************************************************************** */
+/**
+ * @brief   Print the records of a hcasl shared-memory ring (hcasl --ring).
+ * @author  eel3
+ * @date    2026/10/19
+ *
+ * A small consumer of hcasl_ring.h. It prints each record and a newline,
+ * so `hcasl --ring NAME file & hcasl-ring-cat NAME` prints the same as
+ * `hcasl file`.
+ *
+ * @par Compilers
+ * - GCC 12.2.0 on Debian 12
+ */
+/* ********************************************************************** */
+
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#include "hcasl_ring.h"
+
+
+namespace {
+
+/* ---------------------------------------------------------------------- */
+/* Variable */
+/* ---------------------------------------------------------------------- */
+
+std::string program_name;
+
+/** Output buffer. */
+char output_buffer[256 * 1024];
+
+
+/* ---------------------------------------------------------------------- */
+/* Function */
+/* ---------------------------------------------------------------------- */
+
+/* ====================================================================== */
+/**
+ * @brief  Print the usage.
+ *
+ * @param[in,out] out  Output stream.
+ */
+/* ====================================================================== */
+void
+usage(std::ostream &out)
+{
+	out << "usage: " << program_name << " [options] NAME\n"
+	    << "    -k\n"
+	    << "     keep the ring name (do not remove /dev/shm/NAME)\n"
+	    << "    -t SECONDS\n"
+	    << "     wait at most SECONDS for the ring to appear (default: 10)" << std::endl;
+}
+
+} // namespace
+
+/* ********************************************************************** */
+/**
+ * @brief  Main routine.
+ *
+ * @retval EXIT_SUCCESS  OK (success).
+ * @retval EXIT_FAILURE  NG (failure).
+ */
+/* ********************************************************************** */
+int
+main(int argc, char *argv[])
+{
+	using std::cerr;
+	using std::cout;
+	using std::endl;
+
+	const std::string arg0 = argv[0];
+	const auto pos = arg0.find_last_of('/');
+	program_name = (pos == std::string::npos) ? arg0 : arg0.substr(pos + 1);
+
+	bool remove = true;
+	unsigned long timeout = 10;
+
+	int c;
+	while ((c = getopt(argc, argv, "hkt:")) != -1) {
+		switch (c) {
+		case 'h':
+			usage(cout);
+			return EXIT_SUCCESS;
+		case 'k':
+			remove = false;
+			break;
+		case 't':
+			{
+				std::istringstream tbuf(optarg);
+				long t;
+				tbuf >> t;
+				if (!tbuf || (t < 0)) {
+					usage(cerr);
+					return EXIT_FAILURE;
+				}
+				timeout = static_cast<unsigned long>(t);
+			}
+			break;
+		default:
+			usage(cerr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind + 1 != argc) {
+		usage(cerr);
+		return EXIT_FAILURE;
+	}
+	const std::string name = argv[optind];
+
+	hcasl_ring::RingReader ring;
+	if (!ring.open(name, remove, timeout * 1000)) {
+		cerr << program_name << ": " << name << ": cannot open" << endl;
+		return EXIT_FAILURE;
+	}
+
+	// std::cout writes to stdout (synchronized with stdio), so this is its buffer.
+	(void) std::setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+
+	const std::size_t record_size = ring.record_size();
+	const char *records;
+	std::size_t n;
+	while ((n = ring.wait(&records)) > 0) {
+		for (std::size_t i = 0; i < n; ++i) {
+			cout.write(records + i * record_size, static_cast<std::streamsize>(record_size));
+			cout.put('\n');
+		}
+		ring.consume(n);
+	}
+	if (ring.abandoned()) {
+		cerr << program_name << ": " << name << ": the producer has gone" << endl;
+		(void) cout.flush();
+		return EXIT_FAILURE;
+	}
+
+	return cout.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
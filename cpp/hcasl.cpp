@@ -18,20 +18,59 @@
 #endif /* def __linux__ */
 
 #include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 
 #include <algorithm>
-#include <deque>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <mutex>
+#include <random>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include <unistd.h>
 
+#if !defined(_WIN32) && !defined(_WIN64)
+#	include <poll.h>
+#endif /* !defined(_WIN32) && !defined(_WIN64) */
+
+#ifdef __linux__
+#	include <sys/inotify.h>
+#endif /* def __linux__ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#	if defined(__clang__)
+#		if __has_builtin(__builtin_cpu_supports) && __has_include(<avx512vbmiintrin.h>)
+#			define HCASL_X86_DISPATCH
+#		endif
+#	elif defined(__GNUC__) && (__GNUC__ >= 6)
+#		define HCASL_X86_DISPATCH
+#	endif
+#endif /* defined(__x86_64__) || defined(__i386__) */
+
+#ifdef HCASL_X86_DISPATCH
+#	include <immintrin.h>
+#endif /* def HCASL_X86_DISPATCH */
+
 #if defined(_WIN32) || defined(_WIN64)
-#	include <cerrno>
-#	include <fcntl.h>
 #	include <io.h>
 #	ifndef STDIN_FILENO
 #		define STDIN_FILENO 0
@@ -41,139 +80,2171 @@
 #	endif
 #endif /* defined(_WIN32) || defined(_WIN64) */
 
+#ifndef O_BINARY
+#	define O_BINARY 0
+#endif /* ndef O_BINARY */
+
+/* MinGW's win32 thread model (e.g. TDM-GCC 4.8.1) has no std::thread. */
+#if !(defined(__MINGW32__) && defined(__GLIBCXX__) && !defined(_GLIBCXX_HAS_GTHREADS))
+#	define HCASL_THREADS
+#elif defined(_WIN32) || defined(_WIN64)
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif /* ndef NOMINMAX */
+#	include <windows.h>
+#endif /* no win32 thread model */
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#	define HCASL_RING
+#	include "hcasl_ring.h"
+#endif /* !defined(_WIN32) && !defined(_WIN64) */
+
+
+namespace {
+
+/* ---------------------------------------------------------------------- */
+/* Variable */
+/* ---------------------------------------------------------------------- */
+
+std::string program_name;
+
+/** Output buffer (outputs are fully buffered). */
+char output_buffer[256 * 1024];
+
+/** Upper limit of --partition K (each partition has a thread and 2 MiB of buffers). */
+const unsigned long MAX_PARTITIONS = 256;
+
+
+/* ---------------------------------------------------------------------- */
+/* Kernel */
+/* ---------------------------------------------------------------------- */
+
+/* ====================================================================== */
+/**
+ * @brief  Precomputed gather table of a spaced seed.
+ */
+/* ====================================================================== */
+struct GatherTable {
+	static const std::size_t SHUFFLE_SIZE = 64;
+
+	std::size_t span;
+	std::vector<std::size_t> positions;
+	unsigned char shuffle[SHUFFLE_SIZE];	// positions (if span <= 64), padded by 0x80
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Encode n bytes to 2 * n lower case hex digits.
+ *
+ * @param[in]  src  Source bytes.
+ * @param[in]  n    Number of source bytes.
+ * @param[out] dst  Destination (2 * n bytes).
+ */
+/* ====================================================================== */
+void
+hex_encode_generic(const unsigned char *src, std::size_t n, char *dst)
+{
+	static const char DIGITS[] = "0123456789abcdef";
+
+	for (; n > 0; --n, ++src, dst += 2) {
+		dst[0] = DIGITS[*src >> 4];
+		dst[1] = DIGITS[*src & 0x0F];
+	}
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Encode groups of 3 bytes to base64 (4 characters per group).
+ *
+ * @param[in]  src     Source bytes.
+ * @param[in]  groups  Number of 3 byte groups.
+ * @param[out] dst     Destination (4 * groups bytes).
+ */
+/* ====================================================================== */
+void
+base64_encode_groups_generic(const unsigned char *src, std::size_t groups, char *dst)
+{
+	static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	// Two output characters per 12 input bits.
+	struct PairTable {
+		PairTable()
+		{
+			for (int i = 0; i < 4096; ++i) {
+				pairs[2 * i] = ALPHABET[i >> 6];
+				pairs[2 * i + 1] = ALPHABET[i & 0x3F];
+			}
+		}
+		char pairs[2 * 4096];
+	};
+	static const PairTable table;
+
+	for (; groups > 0; --groups, src += 3, dst += 4) {
+		const unsigned long v = (static_cast<unsigned long>(src[0]) << 16) | (src[1] << 8) | src[2];
+		std::memcpy(dst, &table.pairs[2 * (v >> 12)], 2);
+		std::memcpy(dst + 2, &table.pairs[2 * (v & 0xFFF)], 2);
+	}
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Gather the bytes of a window marked in a spaced seed.
+ *
+ * The SIMD variants may read up to 64 bytes from window and write up to
+ * 64 bytes to record.
+ *
+ * @param[in]  table   Gather table of the seed.
+ * @param[in]  window  Window (span bytes).
+ * @param[out] record  Record (weight bytes).
+ */
+/* ====================================================================== */
+void
+gather_generic(const GatherTable &table, const char * const window, char * const record)
+{
+	const std::size_t n = table.positions.size();
+	const std::size_t * const pos = table.positions.data();
+
+	for (std::size_t i = 0; i < n; ++i) {
+		record[i] = window[pos[i]];
+	}
+}
+
+#ifdef HCASL_X86_DISPATCH
+
+/* ====================================================================== */
+/**
+ * @brief  hex_encode_generic() with SSE2 (16 bytes per loop).
+ */
+/* ====================================================================== */
+__attribute__((target("sse2")))
+void
+hex_encode_sse2(const unsigned char *src, std::size_t n, char *dst)
+{
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+
+	for (; n >= 16; n -= 16, src += 16, dst += 32) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		const __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+		const __m128i lo = _mm_and_si128(v, nibble);
+		__m128i a = _mm_unpacklo_epi8(hi, lo);
+		__m128i b = _mm_unpackhi_epi8(hi, lo);
+		a = _mm_add_epi8(_mm_add_epi8(a, zero), _mm_and_si128(_mm_cmpgt_epi8(a, nine), alpha));
+		b = _mm_add_epi8(_mm_add_epi8(b, zero), _mm_and_si128(_mm_cmpgt_epi8(b, nine), alpha));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), a);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), b);
+	}
+	hex_encode_generic(src, n, dst);
+}
+
+/* ====================================================================== */
+/**
+ * @brief  hex_encode_generic() with AVX2 (16 bytes per loop, vpshufb lookup).
+ */
+/* ====================================================================== */
+__attribute__((target("avx2")))
+void
+hex_encode_avx2(const unsigned char *src, std::size_t n, char *dst)
+{
+	const __m256i digits = _mm256_setr_epi8(
+		'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+		'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+	const __m256i nibble = _mm256_set1_epi16(0x0F);
+
+	for (; n >= 16; n -= 16, src += 16, dst += 32) {
+		// Each 16-bit lane gets (low nibble << 8) | high nibble: "hi lo" in memory.
+		const __m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+		const __m256i pair = _mm256_or_si256(_mm256_srli_epi16(v, 4), _mm256_slli_epi16(_mm256_and_si256(v, nibble), 8));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_shuffle_epi8(digits, pair));
+	}
+	hex_encode_generic(src, n, dst);
+}
+
+/* ====================================================================== */
+/**
+ * @brief  base64_encode_groups_generic() with AVX2 (8 groups per loop).
+ *
+ * The loop loads 16 bytes for 12, so it stops while 2 groups remain;
+ * it reads 3 * groups bytes and writes 4 * groups bytes exactly.
+ */
+/* ====================================================================== */
+__attribute__((target("avx2")))
+void
+base64_encode_groups_avx2(const unsigned char *src, std::size_t groups, char *dst)
+{
+	const __m256i split = _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i offsets = _mm256_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+	// 24 bytes (8 groups) per loop; each 128-bit lane loads 16 bytes and uses 12.
+	for (; groups >= 10; groups -= 8, src += 24, dst += 32) {
+		const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 12));
+		__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+		// Split each group into 4 x 6 bits, one per byte.
+		in = _mm256_shuffle_epi8(in, split);
+		const __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00)),
+		                                      _mm256_set1_epi32(0x04000040));
+		const __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0)),
+		                                      _mm256_set1_epi32(0x01000010));
+		const __m256i indices = _mm256_or_si256(t0, t1);
+
+		// Map 0..63 to the alphabet: 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12.
+		__m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+		range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+		const __m256i ascii = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), ascii);
+	}
+	base64_encode_groups_generic(src, groups, dst);
+}
+
+/* ====================================================================== */
+/**
+ * @brief  gather_generic() with AVX2 (vpshufb) for spans up to 32 bytes.
+ *
+ * Reads 16 or 32 bytes from window and writes as many to record, past
+ * span and weight. This relies on WindowBuffer::PADDING readable bytes
+ * after the data and a record of at least GatherTable::SHUFFLE_SIZE bytes.
+ */
+/* ====================================================================== */
+__attribute__((target("avx2")))
+void
+gather_avx2(const GatherTable &table, const char * const window, char * const record)
+{
+	if (table.span <= 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(window));
+		const __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.shuffle));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(record), _mm_shuffle_epi8(v, idx));
+	} else if (table.span <= 32) {
+		// vpshufb does not cross 128-bit lanes: shuffle both halves and blend.
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(window));
+		const __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(table.shuffle));
+		const __m256i lo = _mm256_shuffle_epi8(_mm256_permute2x128_si256(v, v, 0x00), idx);
+		const __m256i hi = _mm256_shuffle_epi8(_mm256_permute2x128_si256(v, v, 0x11), idx);
+		const __m256i use_hi = _mm256_cmpgt_epi8(idx, _mm256_set1_epi8(15));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(record), _mm256_blendv_epi8(lo, hi, use_hi));
+	} else {
+		gather_generic(table, window, record);
+	}
+}
+
+/* ====================================================================== */
+/**
+ * @brief  hex_encode_generic() with AVX-512 (32 bytes per loop).
+ */
+/* ====================================================================== */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+void
+hex_encode_avx512(const unsigned char *src, std::size_t n, char *dst)
+{
+	const __m512i digits = _mm512_broadcast_i32x4(_mm_setr_epi8(
+		'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'));
+	const __m512i nibble = _mm512_set1_epi16(0x0F);
+
+	for (; n >= 32; n -= 32, src += 32, dst += 64) {
+		const __m512i v = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src)));
+		const __m512i pair = _mm512_or_si512(_mm512_srli_epi16(v, 4), _mm512_slli_epi16(_mm512_and_si512(v, nibble), 8));
+		_mm512_storeu_si512(dst, _mm512_shuffle_epi8(digits, pair));
+	}
+	hex_encode_avx2(src, n, dst);
+}
+
+/* ====================================================================== */
+/**
+ * @brief  gather_generic() with AVX-512 VBMI for spans up to 64 bytes.
+ *
+ * The load and the store are masked, so it reads span bytes and writes
+ * weight bytes exactly.
+ */
+/* ====================================================================== */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+void
+gather_avx512(const GatherTable &table, const char * const window, char * const record)
+{
+	if (table.span > 64) {
+		gather_generic(table, window, record);
+		return;
+	}
+
+	const __mmask64 in_mask = (table.span == 64) ? ~UINT64_C(0) : ((UINT64_C(1) << table.span) - 1);
+	const std::size_t weight = table.positions.size();
+	const __mmask64 out_mask = (weight == 64) ? ~UINT64_C(0) : ((UINT64_C(1) << weight) - 1);
+	const __m512i v = _mm512_maskz_loadu_epi8(in_mask, window);
+	const __m512i idx = _mm512_loadu_si512(table.shuffle);
+	_mm512_mask_storeu_epi8(record, out_mask, _mm512_permutexvar_epi8(idx, v));
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Returns true if the CPU supports SSE2.
+ */
+/* ====================================================================== */
+bool
+supports_sse2()
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Returns true if the CPU supports AVX2.
+ */
+/* ====================================================================== */
+bool
+supports_avx2()
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Returns true if the CPU supports AVX-512 F, BW and VBMI.
+ */
+/* ====================================================================== */
+bool
+supports_avx512()
+{
+	return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+	       __builtin_cpu_supports("avx512vbmi");
+}
+
+#endif /* def HCASL_X86_DISPATCH */
+
+/* ====================================================================== */
+/**
+ * @brief  Returns true (the generic variant runs everywhere).
+ */
+/* ====================================================================== */
+bool
+supports_generic()
+{
+	return true;
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Variant of the hot kernels for an instruction set.
+ *
+ * Each variant gives the same output as the generic one. It reads and
+ * writes exactly the same bytes (e.g. n bytes in, 2 * n bytes out for
+ * hex_encode) unless its own comment says otherwise.
+ */
+/* ====================================================================== */
+struct Kernel {
+	const char *name;
+	bool (*supported)();
+	void (*hex_encode)(const unsigned char *src, std::size_t n, char *dst);
+	void (*base64_encode_groups)(const unsigned char *src, std::size_t groups, char *dst);
+	void (*gather)(const GatherTable &table, const char *window, char *record);
+};
+
+/** Kernel variants, from the most portable one. */
+const Kernel KERNELS[] = {
+	{ "generic", supports_generic, hex_encode_generic, base64_encode_groups_generic, gather_generic },
+#ifdef HCASL_X86_DISPATCH
+	{ "sse2",    supports_sse2,    hex_encode_sse2,    base64_encode_groups_generic, gather_generic },
+	{ "avx2",    supports_avx2,    hex_encode_avx2,    base64_encode_groups_avx2,    gather_avx2 },
+	{ "avx512",  supports_avx512,  hex_encode_avx512,  base64_encode_groups_avx2,    gather_avx512 },
+#endif /* def HCASL_X86_DISPATCH */
+};
+
+/** Active kernel (see select_kernel()). */
+const Kernel *kernel = &KERNELS[0];
+
+/* ====================================================================== */
+/**
+ * @brief  Select the kernel variant.
+ *
+ * @param[in] name  Kernel name, or "auto" for the best supported one.
+ *
+ * @retval true   OK.
+ * @retval false  Unknown or unsupported kernel.
+ */
+/* ====================================================================== */
+bool
+select_kernel(const std::string &name)
+{
+#ifdef HCASL_X86_DISPATCH
+	__builtin_cpu_init();
+#endif /* def HCASL_X86_DISPATCH */
+
+	const Kernel *selected = NULL;
+	std::for_each(std::begin(KERNELS), std::end(KERNELS), [&name, &selected] (const Kernel &k) {
+		if (((name == "auto") || (name == k.name)) && k.supported()) {
+			selected = &k;
+		}
+	});
+	if (selected == NULL) {
+		return false;
+	}
+	kernel = selected;
+	return true;
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Encode n bytes to 2 * n lower case hex digits (active kernel).
+ */
+/* ====================================================================== */
+inline void
+hex_encode(const unsigned char *src, std::size_t n, char *dst)
+{
+	kernel->hex_encode(src, n, dst);
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Encode groups of 3 bytes to base64 (active kernel).
+ */
+/* ====================================================================== */
+inline void
+base64_encode_groups(const unsigned char *src, std::size_t groups, char *dst)
+{
+	kernel->base64_encode_groups(src, groups, dst);
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Encode n bytes to padded base64.
+ *
+ * @param[in]  src  Source bytes.
+ * @param[in]  n    Number of source bytes.
+ * @param[out] dst  Destination (4 * ceil(n / 3) bytes).
+ *
+ * @return  Number of characters written.
+ */
+/* ====================================================================== */
+std::size_t
+base64_encode(const unsigned char *src, const std::size_t n, char *dst)
+{
+	const std::size_t groups = n / 3;
+	const std::size_t rest = n % 3;
+
+	base64_encode_groups(src, groups, dst);
+	if (rest == 0) {
+		return 4 * groups;
+	}
+
+	unsigned char tail[3] = { 0, 0, 0 };
+	std::memcpy(tail, src + 3 * groups, rest);
+	base64_encode_groups(tail, 1, dst + 4 * groups);
+	dst[4 * groups + 3] = '=';
+	if (rest == 1) {
+		dst[4 * groups + 2] = '=';
+	}
+	return 4 * (groups + 1);
+}
+
+
+/* ---------------------------------------------------------------------- */
+/* Class */
+/* ---------------------------------------------------------------------- */
+
+/* ====================================================================== */
+/**
+ * @brief  Input file (or stdin), optionally followed like `tail -F`.
+ *
+ * In follow mode, read() does not return EOF but waits for the file to
+ * grow. On Linux it sleeps on inotify events; elsewhere it polls. A
+ * truncated file is read again from the start, and a replaced (rotated)
+ * file is reopened by its name after the rest of the old one is read.
+ * Only regular files can be followed.
+ *
+ * An idle handler (see on_idle()) is called when no input has arrived
+ * for a while, e.g. to flush the output for interactive consumers.
+ */
+/* ====================================================================== */
+class InputFile {
+public:
+	/** Open path ("-" is stdin). Check is_open() for the result. */
+	InputFile(const std::string &path, const bool follow)
+		: m_path(path), m_fd(-1), m_owner(path != "-"), m_follow(follow), m_draining(false), m_idle_ms(0)
+#ifdef __linux__
+		, m_inotify(-1), m_watch(-1)
+#endif /* def __linux__ */
+	{
+		m_fd = m_owner ? open(path.c_str(), O_RDONLY | O_BINARY) : STDIN_FILENO;
+		if (m_fd == -1) {
+			return;
+		}
+
+		struct stat st;
+		if ((fstat(m_fd, &st) == -1) || !S_ISREG(st.st_mode)) {
+			m_follow = false;
+		}
+#ifdef __linux__
+		if (m_follow && m_owner) {
+			m_inotify = inotify_init();
+			if (m_inotify != -1) {
+				// Watch the directory too, to wake up when the file is recreated.
+				const auto pos = m_path.find_last_of('/');
+				const std::string dir = (pos == std::string::npos) ? "." : m_path.substr(0, pos + 1);
+				(void) inotify_add_watch(m_inotify, dir.c_str(), IN_CREATE | IN_MOVED_TO);
+				watch_file();
+			}
+		}
+#endif /* def __linux__ */
+	}
+
+	~InputFile()
+	{
+#ifdef __linux__
+		if (m_inotify != -1) {
+			(void) close(m_inotify);
+		}
+#endif /* def __linux__ */
+		if (m_owner && (m_fd != -1)) {
+			(void) close(m_fd);
+		}
+	}
+
+	InputFile(const InputFile &) = delete;
+	InputFile &operator=(const InputFile &) = delete;
+
+	bool is_open() const { return m_fd != -1; }
+
+	/** Call f when read() has waited ms milliseconds for input. */
+	void on_idle(const int ms, std::function<void()> f)
+	{
+		m_idle_ms = ms;
+		m_idle = std::move(f);
+	}
+
+	/**
+	 * Read at most n bytes like read(2), except that EINTR is retried.
+	 * In follow mode it never returns 0 (EOF).
+	 */
+	long read(char * const p, const std::size_t n)
+	{
+		for (;;) {
+			if (m_idle && !wait_readable(m_fd, m_idle_ms)) {
+				m_idle();
+			}
+			errno = 0;
+			const auto got = ::read(m_fd, p, static_cast<unsigned int>(n));
+			if (got > 0) {
+				return static_cast<long>(got);
+			}
+			if (got < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+
+			if (!m_follow) {
+				return 0;
+			}
+			if (m_draining) {
+				// The rest of the replaced file was read; switch to the new one.
+				reopen();
+			} else if (replaced()) {
+				m_draining = true;
+			} else if (!truncated()) {
+				wait();
+			}
+		}
+	}
+
+private:
+	enum { FOLLOW_INTERVAL_MS = 1000 };
+
+	/** If the file was truncated, rewind it. */
+	bool truncated()
+	{
+		struct stat st;
+		const auto offset = lseek(m_fd, 0, SEEK_CUR);
+
+		if ((fstat(m_fd, &st) == -1) || (offset == -1) || (st.st_size >= offset)) {
+			return false;
+		}
+		std::cerr << program_name << ": " << m_path << ": file truncated" << std::endl;
+		(void) lseek(m_fd, 0, SEEK_SET);
+		return true;
+	}
+
+	/** Returns true if another file has been placed at the path (e.g. log rotation). */
+	bool replaced() const
+	{
+		struct stat cur, now;
+
+		if (!m_owner || (fstat(m_fd, &cur) == -1) || (stat(m_path.c_str(), &now) == -1)) {
+			return false;
+		}
+		return (cur.st_dev != now.st_dev) || (cur.st_ino != now.st_ino);
+	}
+
+	void reopen()
+	{
+		m_draining = false;
+
+		const int fd = open(m_path.c_str(), O_RDONLY | O_BINARY);
+		if (fd == -1) {
+			return;
+		}
+		std::cerr << program_name << ": " << m_path << ": file has been replaced; following new file" << std::endl;
+		(void) close(m_fd);
+		m_fd = fd;
+#ifdef __linux__
+		if (m_inotify != -1) {
+			watch_file();
+		}
+#endif /* def __linux__ */
+	}
+
+	/** Wait until the file may have changed. */
+	void wait()
+	{
+#ifdef __linux__
+		if (m_inotify != -1) {
+			if (m_idle && !wait_readable(m_inotify, m_idle_ms)) {
+				m_idle();
+			}
+			if (wait_readable(m_inotify, FOLLOW_INTERVAL_MS)) {
+				char events[4096];
+				(void) ::read(m_inotify, events, sizeof(events));
+			}
+			return;
+		}
+#endif /* def __linux__ */
+		if (m_idle) {
+			m_idle();
+		}
+#ifdef HCASL_THREADS
+		std::this_thread::sleep_for(std::chrono::milliseconds(FOLLOW_INTERVAL_MS));
+#else /* def HCASL_THREADS */
+		Sleep(FOLLOW_INTERVAL_MS);
+#endif /* def HCASL_THREADS */
+	}
+
+	/**
+	 * Returns true if fd becomes readable within ms milliseconds.
+	 * Windows has no poll(2) for files and pipes, so it is always "idle".
+	 */
+	static bool wait_readable(const int fd, const int ms)
+	{
+#if defined(_WIN32) || defined(_WIN64)
+		(void) fd;
+		(void) ms;
+		return false;
+#else /* defined(_WIN32) || defined(_WIN64) */
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int ret;
+		while (((ret = poll(&pfd, 1, ms)) == -1) && (errno == EINTR)) {
+		}
+		return ret != 0;
+#endif /* defined(_WIN32) || defined(_WIN64) */
+	}
+
+#ifdef __linux__
+	void watch_file()
+	{
+		if (m_watch != -1) {
+			(void) inotify_rm_watch(m_inotify, m_watch);
+		}
+		m_watch = inotify_add_watch(m_inotify, m_path.c_str(),
+		                            IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+	}
+#endif /* def __linux__ */
+
+	std::string m_path;
+	int m_fd;
+	bool m_owner;
+	bool m_follow;
+	bool m_draining;
+	int m_idle_ms;
+	std::function<void()> m_idle;
+#ifdef __linux__
+	int m_inotify;
+	int m_watch;
+#endif /* def __linux__ */
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Contiguous input buffer that keeps the last bytes of each block.
+ *
+ * A block is read directly behind the kept (history) bytes, so every
+ * window that ends in the block is a plain pointer range of the buffer.
+ */
+/* ====================================================================== */
+class WindowBuffer {
+public:
+	static const std::size_t BLOCK_SIZE = 64 * 1024;
+	static const std::size_t PADDING = 64;	// readable bytes behind the data (for SIMD kernels)
+
+	/** The buffer starts at one block and grows with the data (up to history + a block). */
+	explicit WindowBuffer(const std::size_t history)
+		: m_history(history), m_buf(BLOCK_SIZE + PADDING), m_begin(0), m_end(0) {}
+
+	std::size_t history() const { return m_history; }
+	const char *data() const { return m_buf.data() + m_begin; }
+	std::size_t size() const { return m_end - m_begin; }
+
+	/** Returns the free space (at least n bytes) behind the data. */
+	char *reserve(const std::size_t n)
+	{
+		if (m_buf.size() - m_end < n + PADDING) {
+			if (m_begin > 0) {
+				std::memmove(m_buf.data(), data(), size());
+				m_end -= m_begin;
+				m_begin = 0;
+			}
+			if (m_buf.size() - m_end < n + PADDING) {
+				// Grow geometrically while the history fills up.
+				m_buf.resize(std::max(m_end + n + PADDING, m_buf.size() * 2));
+			}
+		}
+		return m_buf.data() + m_end;
+	}
+
+	/** Append n bytes written in the reserved space. */
+	void commit(const std::size_t n)
+	{
+		assert(m_end + n + PADDING <= m_buf.size());
+		m_end += n;
+	}
+
+	/** Drop all but the last history bytes. */
+	void retire()
+	{
+		m_begin = m_end - std::min(size(), m_history);
+	}
+
+private:
+	std::size_t m_history;
+	std::vector<char> m_buf;
+	std::size_t m_begin;
+	std::size_t m_end;
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Output encoding of windows.
+ *
+ * A whole block is encoded once and each window is written as a slice of
+ * the encoded block, so the encoding cost is paid per input byte rather
+ * than per output byte. Hex uses 2 characters per byte, so window k starts
+ * at offset 2k. Base64 encodes 3 byte groups, so the block is encoded in
+ * the 3 possible group phases; window k is a slice of phase k mod 3
+ * followed by its padded tail (N mod 3 bytes).
+ */
+/* ====================================================================== */
+class WindowEncoder {
+public:
+	enum Encoding {
+		RAW,
+		HEX,
+		BASE64,
+	};
+
+	explicit WindowEncoder(const Encoding encoding = RAW)
+		: m_encoding(encoding) {}
+
+	Encoding encoding() const { return m_encoding; }
+
+	/** Encode a block before write_window() is called for it. */
+	void encode_block(const char * const block, const std::size_t size)
+	{
+		auto src = reinterpret_cast<const unsigned char *>(block);
+
+		switch (m_encoding) {
+		case HEX:
+			m_encoded[0].resize(2 * size);
+			hex_encode(src, size, m_encoded[0].data());
+			break;
+		case BASE64:
+			for (std::size_t phase = 0; phase < 3; ++phase) {
+				const std::size_t groups = (size > phase) ? (size - phase) / 3 : 0;
+				m_encoded[phase].resize(4 * groups);
+				base64_encode_groups(src + phase, groups, m_encoded[phase].data());
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	/** Write the n byte window at offset k of the block passed to encode_block(). */
+	void write_window(std::ostream &out, const char * const block, const std::size_t k, const std::size_t n)
+	{
+		switch (m_encoding) {
+		case HEX:
+			out.write(m_encoded[0].data() + 2 * k, static_cast<std::streamsize>(2 * n));
+			break;
+		case BASE64:
+			{
+				const std::size_t groups = n / 3;
+				const std::size_t rest = n % 3;
+				out.write(m_encoded[k % 3].data() + 4 * (k / 3), static_cast<std::streamsize>(4 * groups));
+				if (rest > 0) {
+					char tail[4];
+					base64_encode(reinterpret_cast<const unsigned char *>(block + k + 3 * groups), rest, tail);
+					out.write(tail, sizeof(tail));
+				}
+			}
+			break;
+		default:
+			out.write(block + k, static_cast<std::streamsize>(n));
+			break;
+		}
+	}
+
+	/** Encode and write an n byte record that is not a slice of the block. */
+	void write_record(std::ostream &out, const char * const record, const std::size_t n)
+	{
+		auto src = reinterpret_cast<const unsigned char *>(record);
+
+		switch (m_encoding) {
+		case HEX:
+			m_scratch.resize(2 * n);
+			hex_encode(src, n, m_scratch.data());
+			out.write(m_scratch.data(), static_cast<std::streamsize>(m_scratch.size()));
+			break;
+		case BASE64:
+			m_scratch.resize(4 * ((n + 2) / 3));
+			out.write(m_scratch.data(), static_cast<std::streamsize>(base64_encode(src, n, m_scratch.data())));
+			break;
+		default:
+			out.write(record, static_cast<std::streamsize>(n));
+			break;
+		}
+	}
+
+private:
+	Encoding m_encoding;
+	std::vector<char> m_encoded[3];
+	std::vector<char> m_scratch;
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Spaced seed (gapped window) such as "1101".
+ *
+ * The span of the window is the length of the mask, and only the bytes
+ * at the positions marked '1' are emitted.
+ */
+/* ====================================================================== */
+class SpacedSeed {
+public:
+	/** Throws std::invalid_argument if mask is not a valid spaced seed. */
+	explicit SpacedSeed(const std::string &mask)
+		: m_mask(mask)
+	{
+		if (mask.find_first_not_of("01") != std::string::npos) {
+			throw std::invalid_argument("mask must consist of 0 and 1");
+		}
+		m_table.span = mask.size();
+		std::fill(std::begin(m_table.shuffle), std::end(m_table.shuffle), 0x80);
+		for (std::size_t i = 0; i < mask.size(); ++i) {
+			if (mask[i] == '1') {
+				if (mask.size() <= GatherTable::SHUFFLE_SIZE) {
+					m_table.shuffle[m_table.positions.size()] = static_cast<unsigned char>(i);
+				}
+				m_table.positions.push_back(i);
+			}
+		}
+		if (m_table.positions.empty()) {
+			throw std::invalid_argument("mask must have at least one 1");
+		}
+	}
+
+	const std::string &mask() const { return m_mask; }
+	std::size_t span() const { return m_table.span; }
+	std::size_t weight() const { return m_table.positions.size(); }
+
+	/**
+	 * Gather the marked bytes of the window (span bytes) into record (weight bytes).
+	 * The window must be followed by WindowBuffer::PADDING readable bytes, and
+	 * the record must have room for GatherTable::SHUFFLE_SIZE bytes at least.
+	 */
+	void gather(const char * const window, char * const record) const
+	{
+		kernel->gather(m_table, window, record);
+	}
+
+private:
+	std::string m_mask;
+	GatherTable m_table;
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Write all of n bytes to the file descriptor fd.
+ *
+ * @param[in] fd  File descriptor.
+ * @param[in] p   Bytes.
+ * @param[in] n   Number of bytes.
+ *
+ * @retval true   OK.
+ * @retval false  Write error.
+ */
+/* ====================================================================== */
+bool
+write_fully(const int fd, const char *p, std::size_t n)
+{
+	while (n > 0) {
+		errno = 0;
+		const auto written = write(fd, p, static_cast<unsigned int>(n));
+		if (written > 0) {
+			p += written;
+			n -= static_cast<std::size_t>(written);
+		} else if ((written < 0) && (errno != EINTR)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Output stream buffer of a file descriptor (not owned).
+ *
+ * The standard output is written through this, because pubsetbuf() on
+ * std::cout is a no-op once its file is open (libstdc++).
+ */
+/* ====================================================================== */
+class FileDescriptorBuf : public std::streambuf {
+public:
+	FileDescriptorBuf(const int fd, char * const buffer, const std::size_t size)
+		: m_fd(fd)
+	{
+		setp(buffer, buffer + size);
+	}
+
+	~FileDescriptorBuf()
+	{
+		(void) sync();
+	}
+
+	FileDescriptorBuf(const FileDescriptorBuf &) = delete;
+	FileDescriptorBuf &operator=(const FileDescriptorBuf &) = delete;
+
+protected:
+	int_type overflow(const int_type c) override
+	{
+		if (sync() != 0) {
+			return traits_type::eof();
+		}
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+
+	int sync() override
+	{
+		const bool ok = write_fully(m_fd, pbase(), static_cast<std::size_t>(pptr() - pbase()));
+		setp(pbase(), epptr());
+		return ok ? 0 : -1;
+	}
+
+private:
+	int m_fd;
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Output stream of a file descriptor (not owned).
+ */
+/* ====================================================================== */
+class FileDescriptorStream : public std::ostream {
+public:
+	FileDescriptorStream(const int fd, char * const buffer, const std::size_t size)
+		: std::ostream(nullptr), m_buf(fd, buffer, size)
+	{
+		rdbuf(&m_buf);
+	}
+
+private:
+	FileDescriptorBuf m_buf;
+};
+
+#ifdef HCASL_THREADS
+/* ====================================================================== */
+/**
+ * @brief  Output stream buffer written by its own writer thread.
+ *
+ * While the writer thread writes one buffer to the file, the producer
+ * fills the other one (double buffering). The buffers are not zero
+ * filled, so their pages are only committed as the output grows.
+ */
+/* ====================================================================== */
+class ThreadedFileBuf : public std::streambuf {
+public:
+	static const std::size_t BUFFER_SIZE = 1024 * 1024;
+
+	/**
+	 * Takes the ownership of fd (also when it throws std::bad_alloc or
+	 * std::system_error).
+	 */
+	explicit ThreadedFileBuf(const int fd)
+		: m_fd(fd), m_back_size(0), m_pending(false), m_stop(false), m_error(false)
+	{
+		try {
+			m_front.reset(new char[BUFFER_SIZE]);
+			m_back.reset(new char[BUFFER_SIZE]);
+			m_thread = std::thread(&ThreadedFileBuf::run, this);
+		} catch (...) {
+			(void) close(m_fd);
+			throw;
+		}
+		setp(m_front.get(), m_front.get() + BUFFER_SIZE);
+	}
+
+	~ThreadedFileBuf()
+	{
+		(void) sync();	// errors are reported by flush() in main()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		m_thread.join();
+		(void) close(m_fd);
+	}
+
+	ThreadedFileBuf(const ThreadedFileBuf &) = delete;
+	ThreadedFileBuf &operator=(const ThreadedFileBuf &) = delete;
+
+protected:
+	int_type overflow(const int_type c) override
+	{
+		if (!hand_off()) {
+			return traits_type::eof();
+		}
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+
+	int sync() override
+	{
+		if (!hand_off()) {
+			return -1;
+		}
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [this] { return !m_pending; });
+		return m_error ? -1 : 0;
+	}
+
+private:
+	/** Pass the filled buffer to the writer thread. */
+	bool hand_off()
+	{
+		const std::size_t size = static_cast<std::size_t>(pptr() - pbase());
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (size == 0) {
+			return !m_error;
+		}
+		m_cond.wait(lock, [this] { return !m_pending; });
+		m_front.swap(m_back);
+		m_back_size = size;
+		m_pending = true;
+		const bool ok = !m_error;
+		lock.unlock();
+		m_cond.notify_all();
+
+		setp(m_front.get(), m_front.get() + BUFFER_SIZE);
+		return ok;
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		for (;;) {
+			m_cond.wait(lock, [this] { return m_pending || m_stop; });
+			if (!m_pending) {
+				break;
+			}
+
+			lock.unlock();
+			const bool ok = write_fully(m_fd, m_back.get(), m_back_size);
+			lock.lock();
+
+			m_error = m_error || !ok;
+			m_pending = false;
+			m_cond.notify_all();
+		}
+	}
+
+	int m_fd;
+	std::unique_ptr<char[]> m_front;	// filled by the producer
+	std::unique_ptr<char[]> m_back;		// written by the writer thread
+	std::size_t m_back_size;
+	bool m_pending;
+	bool m_stop;
+	bool m_error;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::thread m_thread;
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Output file stream written by its own writer thread.
+ */
+/* ====================================================================== */
+class ThreadedFileStream : public std::ostream {
+public:
+	/** Takes the ownership of fd. */
+	explicit ThreadedFileStream(const int fd)
+		: std::ostream(nullptr), m_buf(fd)
+	{
+		rdbuf(&m_buf);
+	}
+
+private:
+	ThreadedFileBuf m_buf;
+};
+#endif /* def HCASL_THREADS */
+
+/* ====================================================================== */
+/**
+ * @brief  Rabin-Karp rolling hash of the last N bytes.
+ */
+/* ====================================================================== */
+class RollingHash {
+public:
+	explicit RollingHash(unsigned long bytes)
+		: m_hash(0), m_outgoing(1)
+	{
+		// BASE^N by squaring (N may be huge).
+		for (std::uint64_t base = BASE; bytes > 0; bytes >>= 1, base *= base) {
+			if (bytes & 1) {
+				m_outgoing *= base;
+			}
+		}
+	}
+
+	/** Returns the hash value of n bytes (the same as the rolling one). */
+	static std::uint64_t of(const unsigned char *p, std::size_t n)
+	{
+		RollingHash hash(0);
+		for (; n > 0; --n) {
+			hash.push(*p++);
+		}
+		return hash.value();
+	}
+
+	/** Start a new empty window. */
+	void reset()
+	{
+		m_hash = 0;
+	}
+
+	/** Append a byte to a window that is not full yet. */
+	void push(const unsigned char in)
+	{
+		m_hash = m_hash * BASE + in;
+	}
+
+	/** Append a byte and drop the oldest one (out) from a full window. */
+	void roll(const unsigned char in, const unsigned char out)
+	{
+		m_hash = m_hash * BASE + in - out * m_outgoing;
+	}
+
+	/** Returns the well mixed hash value of the current window. */
+	std::uint64_t value() const
+	{
+		// MurmurHash3 fmix64: spread the polynomial hash over all 64 bits.
+		std::uint64_t h = m_hash;
+		h ^= h >> 33;
+		h *= UINT64_C(0xff51afd7ed558ccd);
+		h ^= h >> 33;
+		h *= UINT64_C(0xc4ceb9fe1a85ec53);
+		h ^= h >> 33;
+		return h;
+	}
+
+private:
+	static const std::uint64_t BASE = UINT64_C(0x100000001b3);
+
+	std::uint64_t m_hash;
+	std::uint64_t m_outgoing;	// BASE^N (mod 2^64)
+};
+
+/* ====================================================================== */
+/**
+ * @brief  HyperLogLog cardinality sketch.
+ *
+ * Serialized form (all integers are little endian):
+ *
+ * | offset | size  | field                          |
+ * |-------:|------:|:-------------------------------|
+ * |      0 |     8 | magic "HCASLHLL"               |
+ * |      8 |     1 | format version (1)             |
+ * |      9 |     1 | precision P                    |
+ * |     10 |     2 | reserved (0)                   |
+ * |     12 |     4 | window size N                  |
+ * |     16 |   2^P | registers                      |
+ */
+/* ====================================================================== */
+class HyperLogLog {
+public:
+	static const unsigned int MIN_PRECISION = 4;
+	static const unsigned int MAX_PRECISION = 18;
+
+	HyperLogLog(const unsigned int precision, const unsigned long bytes)
+		: m_precision(precision), m_bytes(bytes), m_registers(1UL << precision, 0)
+	{
+		assert((precision >= MIN_PRECISION) && (precision <= MAX_PRECISION));
+	}
+
+	unsigned int precision() const { return m_precision; }
+	unsigned long bytes() const { return m_bytes; }
+
+	/** Add a 64-bit hash value to the sketch. */
+	void add(const std::uint64_t hash)
+	{
+		const std::size_t index = static_cast<std::size_t>(hash >> (64 - m_precision));
+		std::uint64_t w = hash << m_precision;
+		unsigned char rank = 1;
+		const unsigned char max_rank = static_cast<unsigned char>(64 - m_precision + 1);
+
+		while ((rank < max_rank) && ((w & (UINT64_C(1) << 63)) == 0)) {
+			w <<= 1;
+			++rank;
+		}
+		if (rank > m_registers[index]) {
+			m_registers[index] = rank;
+		}
+	}
+
+	/** Merge other into this sketch. Returns false if they are not compatible. */
+	bool merge(const HyperLogLog &other)
+	{
+		if ((other.m_precision != m_precision) || (other.m_bytes != m_bytes)) {
+			return false;
+		}
+		std::transform(m_registers.cbegin(), m_registers.cend(),
+		               other.m_registers.cbegin(), m_registers.begin(),
+		               [] (const unsigned char a, const unsigned char b) {
+			return std::max(a, b);
+		});
+		return true;
+	}
+
+	/** Returns the estimated number of distinct hash values. */
+	std::uint64_t estimate() const
+	{
+		const double m = static_cast<double>(m_registers.size());
+		double alpha;
+
+		switch (m_registers.size()) {
+		case 16: alpha = 0.673; break;
+		case 32: alpha = 0.697; break;
+		case 64: alpha = 0.709; break;
+		default: alpha = 0.7213 / (1.0 + 1.079 / m); break;
+		}
+
+		double sum = 0.0;
+		unsigned long zeros = 0;
+		for (auto r : m_registers) {
+			sum += std::ldexp(1.0, -static_cast<int>(r));
+			if (r == 0) {
+				++zeros;
+			}
+		}
+
+		double e = alpha * m * m / sum;
+		if ((e <= 2.5 * m) && (zeros > 0)) {
+			// Small range correction (linear counting).
+			e = m * std::log(m / static_cast<double>(zeros));
+		}
+		return static_cast<std::uint64_t>(e + 0.5);
+	}
+
+	/** Write the serialized sketch. */
+	void save(std::ostream &out) const
+	{
+		char header[HEADER_SIZE] = { 'H', 'C', 'A', 'S', 'L', 'H', 'L', 'L', VERSION };
+		header[9] = static_cast<char>(m_precision);
+		for (int i = 0; i < 4; ++i) {
+			header[12 + i] = static_cast<char>((m_bytes >> (8 * i)) & 0xFF);
+		}
+		out.write(header, sizeof(header));
+		out.write(reinterpret_cast<const char *>(m_registers.data()),
+		          static_cast<std::streamsize>(m_registers.size()));
+	}
+
+	/**
+	 * Read a serialized sketch.
+	 * Returns false on a clean EOF; throws std::runtime_error on broken data.
+	 */
+	static bool load(std::istream &in, std::vector<HyperLogLog> &sketches)
+	{
+		char header[HEADER_SIZE];
+
+		if (!in.read(header, sizeof(header))) {
+			if (in.gcount() == 0) {
+				return false;
+			}
+			throw std::runtime_error("truncated sketch header");
+		}
+		if ((std::string(header, 8) != "HCASLHLL") || (header[8] != VERSION)) {
+			throw std::runtime_error("not a sketch file");
+		}
+
+		const unsigned int precision = static_cast<unsigned char>(header[9]);
+		if ((precision < MIN_PRECISION) || (precision > MAX_PRECISION)) {
+			throw std::runtime_error("unsupported sketch precision");
+		}
+		unsigned long bytes = 0;
+		for (int i = 0; i < 4; ++i) {
+			bytes |= static_cast<unsigned long>(static_cast<unsigned char>(header[12 + i])) << (8 * i);
+		}
+
+		HyperLogLog sketch(precision, bytes);
+		if (!in.read(reinterpret_cast<char *>(sketch.m_registers.data()),
+		             static_cast<std::streamsize>(sketch.m_registers.size()))) {
+			throw std::runtime_error("truncated sketch registers");
+		}
+		sketches.push_back(std::move(sketch));
+		return true;
+	}
+
+private:
+	static const std::size_t HEADER_SIZE = 16;
+	static const char VERSION = 1;
+
+	unsigned int m_precision;
+	unsigned long m_bytes;
+	std::vector<unsigned char> m_registers;
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Seedable random source of the sampling modes.
+ *
+ * Only the engine (fully specified by the standard) is used, not the
+ * std:: distributions, so a seed gives the same sample everywhere.
+ */
+/* ====================================================================== */
+class Random {
+public:
+	explicit Random(const std::uint64_t seed) : m_engine(seed) {}
+
+	/** Returns a uniform random number in [0, 1). */
+	double uniform()
+	{
+		return std::ldexp(static_cast<double>(m_engine() >> 11), -53);
+	}
+
+	/** Returns a uniform random number in (0, 1). */
+	double uniform_open()
+	{
+		double u;
+		while ((u = uniform()) == 0.0) {
+		}
+		return u;
+	}
+
+	/** Returns a uniform random integer in [0, n). */
+	std::uint64_t below(const std::uint64_t n)
+	{
+		return m_engine() % n;
+	}
+
+	/**
+	 * Returns the number of failures before the first success of
+	 * Bernoulli trials with the probability p (geometric distribution).
+	 */
+	std::uint64_t geometric(const double p)
+	{
+		const std::uint64_t never = UINT64_C(9000000000000000000);
+		if (p >= 1.0) {
+			return 0;
+		}
+		if (!(p > 0.0)) {
+			return never;
+		}
+		const double g = std::floor(std::log1p(-uniform()) / std::log1p(-p));
+		return (g < 9.0e18) ? static_cast<std::uint64_t>(g) : never;
+	}
+
+private:
+	std::mt19937_64 m_engine;
+};
+
+/* ====================================================================== */
+/**
+ * @brief  State of the --sample-rate mode (Bernoulli sampling).
+ *
+ * The gap to the next sampled window is drawn from the geometric
+ * distribution, so the skipped windows cost nothing.
+ */
+/* ====================================================================== */
+struct BernoulliSample {
+	BernoulliSample(const double rate, Random &random)
+		: rate(rate), random(random), windows(0), next(random.geometric(rate)) {}
+
+	double rate;
+	Random &random;
+	std::uint64_t windows;	// number of windows seen
+	std::uint64_t next;	// index of the next sampled window
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Uniform sample of K windows in one pass (--reservoir K).
+ *
+ * Vitter's reservoir sampling with Li's "Algorithm L": after the
+ * reservoir is filled, the index of the next window to take is drawn
+ * directly, so the skipped windows cost nothing.
+ */
+/* ====================================================================== */
+class Reservoir {
+public:
+	explicit Reservoir(Random &random)
+		: m_capacity(0), m_bytes(0), m_random(random),
+		  m_size(0), m_w(1.0), m_next(0), m_seen(0) {}
+
+	/** Allocate room for capacity windows of bytes; false if it is too large. */
+	bool allocate(const std::size_t capacity, const std::size_t bytes)
+	{
+		assert((capacity > 0) && (bytes > 0));
+
+		if (capacity > SIZE_MAX / bytes) {
+			return false;
+		}
+		try {
+			m_windows.resize(capacity * bytes);
+			m_offsets.reserve(capacity);
+		} catch (const std::bad_alloc &) {
+			return false;
+		}
+		m_capacity = capacity;
+		m_bytes = bytes;
+		return true;
+	}
+
+	std::size_t bytes() const { return m_bytes; }
+	std::size_t size() const { return m_size; }
+
+	/** Number of windows seen. */
+	std::uint64_t seen() const { return m_seen; }
+	void seen(const std::uint64_t n) { m_seen = n; }
+
+	/** Index of the next window to take. */
+	std::uint64_t next() const { return m_next; }
+
+	/** Take the window of index next(). */
+	void take(const char * const window)
+	{
+		std::size_t slot;
+
+		if (m_size < m_capacity) {
+			slot = m_size++;
+			m_offsets.push_back(m_next);
+			if (m_size == m_capacity) {
+				m_w = std::exp(std::log(m_random.uniform_open()) / static_cast<double>(m_capacity));
+				m_next += m_random.geometric(m_w);
+			}
+		} else {
+			slot = static_cast<std::size_t>(m_random.below(m_capacity));
+			m_offsets[slot] = m_next;
+			m_w *= std::exp(std::log(m_random.uniform_open()) / static_cast<double>(m_capacity));
+			m_next += m_random.geometric(m_w);
+		}
+		std::memcpy(&m_windows[slot * m_bytes], window, m_bytes);
+		++m_next;
+	}
+
+	/** Returns the sampled windows as (offset, window) in the order of offsets. */
+	std::vector<std::pair<std::uint64_t, const char *>> windows() const
+	{
+		std::vector<std::pair<std::uint64_t, const char *>> result;
+		for (std::size_t i = 0; i < m_size; ++i) {
+			result.emplace_back(m_offsets[i], &m_windows[i * m_bytes]);
+		}
+		std::sort(result.begin(), result.end());
+		return result;
+	}
+
+private:
+	std::size_t m_capacity;
+	std::size_t m_bytes;
+	Random &m_random;
+	std::vector<char> m_windows;
+	std::vector<std::uint64_t> m_offsets;
+	std::size_t m_size;
+	double m_w;
+	std::uint64_t m_next;
+	std::uint64_t m_seen;
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Run state of the --collapse mode.
+ */
+/* ====================================================================== */
+struct CollapseState {
+	CollapseState() : run(0), count(0) {}
+
+	unsigned long run;		// length of the run of the newest byte (<= N + 1)
+	unsigned long long count;	// repeat count of the pending window (0: none)
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Distinct window counter for one window size.
+ */
+/* ====================================================================== */
+struct DistinctCounter {
+	DistinctCounter(const unsigned long bytes, const unsigned int precision)
+		: bytes(bytes), hash(bytes), sketch(precision, bytes) {}
+
+	unsigned long bytes;
+	RollingHash hash;
+	HyperLogLog sketch;
+};
+
+
+/* ---------------------------------------------------------------------- */
+/* Function */
+/* ---------------------------------------------------------------------- */
+
+/* ====================================================================== */
+/**
+ * @brief  Returns a slice of the string s,
+ *         with all trailing characters contained in chars removed.
+ *
+ * @param[in] s      .
+ * @param[in] chars  .
+ *
+ * @return  .
+ */
+/* ====================================================================== */
+std::string
+trim_right(const std::string &s, const std::string &chars = "\t\n\v\f\r ")
+{
+	auto rpos = s.find_last_not_of(chars);
+
+	return (rpos == std::string::npos) ? std::string() : s.substr(0, rpos + 1);
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Tiny copy of basename(3).
+ *
+ * @param[in] *s  (See man 3 basename).
+ *
+ * @return  (See man 3 basename).
+ */
+/* ====================================================================== */
+std::string
+my_basename(const char * const s)
+{
+	using std::string;
+
+	static const string DOT = ".";
+	static const string SEP = "/";
+#if defined(_WIN32) || defined(_WIN64)
+	static const string WSEP = "\\";
+	static const string SEPS = SEP + WSEP;
+#else /* defined(_WIN32) || defined(_WIN64) */
+	static const string SEPS = SEP;
+#endif /* defined(_WIN32) || defined(_WIN64) */
+
+	if (s == NULL) {
+		return DOT;
+	}
+
+	string path = s;
+
+	if (path.empty()) {
+		return DOT;
+	}
+	if (path == SEP) {
+		return SEP;
+	}
+#if defined(_WIN32) || defined(_WIN64)
+	if (path == WSEP) {
+		return WSEP;
+	}
+#endif /* defined(_WIN32) || defined(_WIN64) */
+
+	path = trim_right(path, SEPS);
+
+	auto pos = path.find_last_of(SEPS);
+	return (pos == std::string::npos) ? path : path.substr(pos + 1);
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Print the usage.
+ *
+ * @param[in,out] out  Output stream.
+ */
+/* ====================================================================== */
+void
+usage(std::ostream &out)
+{
+	out << "usage: " << program_name << " [options] [file...]\n"
+	    << "    -f, --follow\n"
+	    << "     keep reading the last file as it grows (like tail -F)\n"
+	    << "    --flush-after MS\n"
+	    << "     flush the output when no input has arrived for MS milliseconds\n"
+	    << "     (default: flush only when the buffer is full, or 100 with -f)\n"
+	    << "    --kernel NAME\n"
+	    << "     use the NAME variant of the SIMD kernels (default: auto);\n"
+	    << "     --kernel list prints the variants (* is the active one)\n"
+	    << "    -n N\n"
+	    << "     print the N bytes per line (N >= 1)\n"
+	    << "     (may be given more than once with --distinct)\n"
+	    << "    -o FILE\n"
+	    << "     place output in file FILE\n"
+	    << "    --partition K\n"
+	    << "     place the output in files FILE.0 ... FILE.K-1 (FILE is given by -o);\n"
+	    << "     each window goes to the file selected by its hash (1 <= K <= " << MAX_PARTITIONS << ")\n"
+	    << "    --collapse\n"
+	    << "     print each run of identical consecutive windows once,\n"
+	    << "     prefixed by the repeat count and a tab\n"
+	    << "    --sample-rate P\n"
+	    << "     print each window with the probability P (0 < P <= 1)\n"
+	    << "    --reservoir K\n"
+	    << "     print a uniform sample of K windows, prefixed by the offset and a tab\n"
+	    << "    --seed S\n"
+	    << "     seed of --sample-rate and --reservoir (default: random)\n"
+	    << "    --ring NAME\n"
+	    << "     write the windows as fixed-size records to the shared-memory\n"
+	    << "     ring NAME (/dev/shm/NAME) instead of the output; see hcasl_ring.h\n"
+	    << "    --mask MASK\n"
+	    << "     print only the bytes marked 1 in MASK (e.g. 1101) of each\n"
+	    << "     window of MASK length (overrides -n, may be given more than once)\n"
+	    << "    -x, --hex\n"
+	    << "     print each window in lower case hex\n"
+	    << "    --base64\n"
+	    << "     print each window in base64\n"
+	    << "    --distinct\n"
+	    << "     print the estimated number of distinct N byte windows\n"
+	    << "    --precision P\n"
+	    << "     use 2^P registers for --distinct (" << +HyperLogLog::MIN_PRECISION
+	    << " <= P <= " << +HyperLogLog::MAX_PRECISION << ", default 14)\n"
+	    << "    --save-sketch FILE\n"
+	    << "     save the --distinct sketches in file FILE\n"
+	    << "    --merge\n"
+	    << "     read saved sketches from file... and merge them (implies --distinct)" << std::endl;
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Print the kernel variants.
+ *
+ * @param[in,out] out  Output stream.
+ */
+/* ====================================================================== */
+void
+list_kernels(std::ostream &out)
+{
+	std::for_each(std::begin(KERNELS), std::end(KERNELS), [&out] (const Kernel &k) {
+		out << ((&k == kernel) ? "* " : "  ") << k.name
+		    << (k.supported() ? "" : " (not supported by this CPU)") << '\n';
+	});
+	out.flush();
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Print the version.
+ */
+/* ====================================================================== */
+void
+version(void)
+{
+	std::cout << program_name << " 1.0.0" << std::endl;
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Select the output of a record by its hash.
+ *
+ * @param[in] outs  Output streams.
+ * @param[in] p     Record.
+ * @param[in] n     Size of the record.
+ *
+ * @return  Output stream.
+ */
+/* ====================================================================== */
+std::ostream &
+select_output(const std::vector<std::ostream *> &outs, const char * const p, const std::size_t n)
+{
+	if (outs.size() == 1) {
+		return *outs.front();
+	}
+	const auto hash = RollingHash::of(reinterpret_cast<const unsigned char *>(p), n);
+	return *outs[static_cast<std::size_t>(hash % outs.size())];
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Read the input block by block.
+ *
+ * @param[in,out] in   Input file.
+ * @param[in,out] buf  Working buffer.
+ * @param[in]     f    Called with the number of new bytes after each block.
+ *
+ * @retval true   OK (EOF).
+ * @retval false  Read error.
+ */
+/* ====================================================================== */
+template <typename F>
+bool
+read_blocks(InputFile &in, WindowBuffer &buf, F f)
+{
+	for (;;) {
+		char * const p = buf.reserve(WindowBuffer::BLOCK_SIZE);
+		const auto n = in.read(p, WindowBuffer::BLOCK_SIZE);
+		if (n < 0) {
+			return false;
+		}
+		if (n == 0) {
+			return true;
+		}
+		buf.commit(static_cast<std::size_t>(n));
+		f(static_cast<std::size_t>(n));
+		buf.retire();
+	}
+}
+
+/* ====================================================================== */
+/**
+ * @brief  "head -c && shift 1 byte" loop.
+ *
+ * With more than one output, each window goes to the output selected by
+ * the rolling hash of the window, so equal windows go to the same one.
+ *
+ * @param[in,out] in       Input file.
+ * @param[in,out] outs     Output streams.
+ * @param[in]     bytes    `head -c <bytes>`.
+ * @param[in,out] encoder  Output encoding.
+ * @param[in,out] buf      Working buffer (history == bytes - 1).
+ *
+ * @retval true   OK.
+ * @retval false  Read error.
+ */
+/* ====================================================================== */
+bool
+hcasl(InputFile &in, const std::vector<std::ostream *> &outs, const unsigned long bytes, WindowEncoder &encoder, WindowBuffer &buf)
+{
+	assert(buf.history() == bytes - 1);
+	assert(!outs.empty());
+
+	RollingHash hash(bytes);
+
+	return read_blocks(in, buf, [&] (std::size_t) {
+		const std::size_t size = buf.size();
+		if (size < bytes) {
+			return;
+		}
+		const char * const block = buf.data();
+		auto ublock = reinterpret_cast<const unsigned char *>(block);
+		encoder.encode_block(block, size);
+
+		if (outs.size() == 1) {
+			std::ostream &out = *outs.front();
+			for (std::size_t k = 0; k + bytes <= size; ++k) {
+				encoder.write_window(out, block, k, bytes);
+				out.put('\n');
+			}
+			return;
+		}
+
+		hash.reset();
+		for (std::size_t i = 0; i < bytes; ++i) {
+			hash.push(ublock[i]);
+		}
+		for (std::size_t k = 0; k + bytes <= size; ++k) {
+			if (k > 0) {
+				hash.roll(ublock[k + bytes - 1], ublock[k - 1]);
+			}
+			std::ostream &out = *outs[static_cast<std::size_t>(hash.value() % outs.size())];
+			encoder.write_window(out, block, k, bytes);
+			out.put('\n');
+		}
+	});
+}
+
+/* ====================================================================== */
+/**
+ * @brief  "head -c && shift 1 byte" loop that prints a Bernoulli sample.
+ *
+ * @param[in,out] in       Input file.
+ * @param[in,out] outs     Output streams (selected by the hash of each window).
+ * @param[in]     bytes    `head -c <bytes>`.
+ * @param[in,out] encoder  Output encoding.
+ * @param[in,out] sample   Sampling state (kept across inputs).
+ * @param[in,out] buf      Working buffer (history == bytes - 1).
+ *
+ * @retval true   OK.
+ * @retval false  Read error.
+ */
+/* ====================================================================== */
+bool
+hcasl_sample(InputFile &in, const std::vector<std::ostream *> &outs, const unsigned long bytes,
+             WindowEncoder &encoder, BernoulliSample &sample, WindowBuffer &buf)
+{
+	assert(buf.history() == bytes - 1);
+
+	return read_blocks(in, buf, [&] (std::size_t) {
+		const std::size_t size = buf.size();
+		if (size < bytes) {
+			return;
+		}
+		const char * const block = buf.data();
+		const std::uint64_t count = size - bytes + 1;
+		bool encoded = false;
+
+		for (; sample.next < sample.windows + count; sample.next += 1 + sample.random.geometric(sample.rate)) {
+			if (!encoded) {
+				encoder.encode_block(block, size);
+				encoded = true;
+			}
+			const std::size_t k = static_cast<std::size_t>(sample.next - sample.windows);
+			std::ostream &out = select_output(outs, block + k, bytes);
+			encoder.write_window(out, block, k, bytes);
+			out.put('\n');
+		}
+		sample.windows += count;
+	});
+}
 
-namespace {
+/* ====================================================================== */
+/**
+ * @brief  "head -c && shift 1 byte" loop that fills a reservoir sample.
+ *
+ * @param[in,out] in         Input file.
+ * @param[in,out] reservoir  Reservoir (kept across inputs).
+ * @param[in,out] buf        Working buffer (history == window size - 1).
+ *
+ * @retval true   OK.
+ * @retval false  Read error.
+ */
+/* ====================================================================== */
+bool
+hcasl_reservoir(InputFile &in, Reservoir &reservoir, WindowBuffer &buf)
+{
+	const std::size_t bytes = reservoir.bytes();
+	assert(buf.history() == bytes - 1);
 
-/* ---------------------------------------------------------------------- */
-/* Variable */
-/* ---------------------------------------------------------------------- */
+	return read_blocks(in, buf, [&] (std::size_t) {
+		const std::size_t size = buf.size();
+		if (size < bytes) {
+			return;
+		}
+		const char * const block = buf.data();
+		const std::uint64_t windows = reservoir.seen() + (size - bytes + 1);
 
-std::string program_name;
+		while (reservoir.next() < windows) {
+			reservoir.take(block + static_cast<std::size_t>(reservoir.next() - reservoir.seen()));
+		}
+		reservoir.seen(windows);
+	});
+}
 
+/* ====================================================================== */
+/**
+ * @brief  Print the reservoir sample.
+ *
+ * Each window is prefixed by its offset in the input and a tab.
+ *
+ * @param[in,out] outs       Output streams.
+ * @param[in,out] encoder    Output encoding.
+ * @param[in]     reservoir  Reservoir.
+ */
+/* ====================================================================== */
+void
+reservoir_finish(const std::vector<std::ostream *> &outs, WindowEncoder &encoder, const Reservoir &reservoir)
+{
+	const std::size_t bytes = reservoir.bytes();
 
-/* ---------------------------------------------------------------------- */
-/* Function */
-/* ---------------------------------------------------------------------- */
+	for (const auto &sample : reservoir.windows()) {
+		std::ostream &out = select_output(outs, sample.second, bytes);
+		out << sample.first << '\t';
+		encoder.write_record(out, sample.second, bytes);
+		out.put('\n');
+	}
+}
 
+#ifdef HCASL_RING
 /* ====================================================================== */
 /**
- * @brief  Returns a slice of the string s,
- *         with all trailing characters contained in chars removed.
+ * @brief  "head -c && shift 1 byte" loop to a shared-memory ring.
  *
- * @param[in] s      .
- * @param[in] chars  .
+ * Each window is copied to a fixed-size record of the ring. The records
+ * of a block are published to the consumer at once. Throws
+ * std::runtime_error if the consumer has gone (RingWriter::write()).
  *
- * @return  .
+ * @param[in,out] in     Input file.
+ * @param[in,out] ring   Ring (record size == bytes).
+ * @param[in]     bytes  `head -c <bytes>`.
+ * @param[in,out] buf    Working buffer (history == bytes - 1).
+ *
+ * @retval true   OK.
+ * @retval false  Read error.
  */
 /* ====================================================================== */
-std::string
-trim_right(const std::string &s, const std::string &chars = "\t\n\v\f\r ")
+bool
+hcasl_to_ring(InputFile &in, hcasl_ring::RingWriter &ring, const unsigned long bytes, WindowBuffer &buf)
 {
-	auto rpos = s.find_last_not_of(chars);
+	assert(buf.history() == bytes - 1);
+	assert(ring.record_size() == bytes);
 
-	return (rpos == std::string::npos) ? std::string() : s.substr(0, rpos + 1);
+	return read_blocks(in, buf, [&] (std::size_t) {
+		const std::size_t size = buf.size();
+		const char * const block = buf.data();
+
+		for (std::size_t k = 0; k + bytes <= size; ++k) {
+			ring.write(block + k);
+		}
+		ring.publish();
+	});
 }
+#endif /* def HCASL_RING */
 
 /* ====================================================================== */
 /**
- * @brief  Tiny copy of basename(3).
+ * @brief  "head -c && shift 1 byte" loop that collapses repeated windows.
  *
- * @param[in] *s  (See man 3 basename).
+ * Each run of consecutive identical windows is printed once, prefixed by
+ * its repeat count and a tab. Window k+1 equals window k if and only if
+ * the N+1 bytes k ... k+N are all the same, so the runs are detected in
+ * O(1) per byte by tracking how long the current byte has repeated.
+ * The last run is pending until collapse_finish() is called.
  *
- * @return  (See man 3 basename).
+ * @param[in,out] in       Input file.
+ * @param[in,out] outs     Output streams (selected by the hash of each window).
+ * @param[in]     bytes    `head -c <bytes>`.
+ * @param[in,out] encoder  Output encoding.
+ * @param[in,out] state    Run state (kept across inputs).
+ * @param[in,out] buf      Working buffer (history == bytes).
+ *
+ * @retval true   OK.
+ * @retval false  Read error.
  */
 /* ====================================================================== */
-std::string
-my_basename(const char * const s)
+bool
+hcasl_collapse(InputFile &in, const std::vector<std::ostream *> &outs, const unsigned long bytes,
+               WindowEncoder &encoder, CollapseState &state, WindowBuffer &buf)
 {
-	using std::string;
+	assert(buf.history() == bytes);
 
-	static const string DOT = ".";
-	static const string SEP = "/";
-#if defined(_WIN32) || defined(_WIN64)
-	static const string WSEP = "\\";
-	static const string SEPS = SEP + WSEP;
-#else /* defined(_WIN32) || defined(_WIN64) */
-	static const string SEPS = SEP;
-#endif /* defined(_WIN32) || defined(_WIN64) */
+	return read_blocks(in, buf, [&] (const std::size_t n) {
+		const std::size_t size = buf.size();
+		const char * const block = buf.data();
+		bool encoded = false;
 
-	if (s == NULL) {
-		return DOT;
-	}
+		for (std::size_t end = size - n + 1; end <= size; ++end) {
+			const bool same_byte = (end >= 2) && (block[end - 1] == block[end - 2]);
+			state.run = same_byte ? std::min(state.run + 1, bytes + 1) : 1;
+			if (end < bytes) {
+				continue;
+			}
 
-	string path = s;
+			if ((state.count > 0) && (state.run > bytes)) {
+				++state.count;
+				continue;
+			}
+			if (state.count > 0) {
+				// The previous window (at end - bytes - 1) ends a run.
+				if (!encoded) {
+					encoder.encode_block(block, size);
+					encoded = true;
+				}
+				const std::size_t k = end - bytes - 1;
+				std::ostream &out = select_output(outs, block + k, bytes);
+				out << state.count << '\t';
+				encoder.write_window(out, block, k, bytes);
+				out.put('\n');
+			}
+			state.count = 1;
+		}
+	});
+}
 
-	if (path.empty()) {
-		return DOT;
-	}
-	if (path == SEP) {
-		return SEP;
-	}
-#if defined(_WIN32) || defined(_WIN64)
-	if (path == WSEP) {
-		return WSEP;
+/* ====================================================================== */
+/**
+ * @brief  Print the pending run of hcasl_collapse().
+ *
+ * @param[in,out] outs     Output streams.
+ * @param[in]     bytes    `head -c <bytes>`.
+ * @param[in,out] encoder  Output encoding.
+ * @param[in,out] state    Run state.
+ * @param[in]     buf      Working buffer (history == bytes).
+ */
+/* ====================================================================== */
+void
+collapse_finish(const std::vector<std::ostream *> &outs, const unsigned long bytes,
+                WindowEncoder &encoder, CollapseState &state, const WindowBuffer &buf)
+{
+	if (state.count == 0) {
+		return;
 	}
-#endif /* defined(_WIN32) || defined(_WIN64) */
 
-	path = trim_right(path, SEPS);
+	const std::size_t size = buf.size();
+	const char * const block = buf.data();
+	assert(size >= bytes);
 
-	auto pos = path.find_last_of(SEPS);
-	return (pos == std::string::npos) ? path : path.substr(pos + 1);
+	encoder.encode_block(block, size);
+	std::ostream &out = select_output(outs, block + size - bytes, bytes);
+	out << state.count << '\t';
+	encoder.write_window(out, block, size - bytes, bytes);
+	out.put('\n');
+	state.count = 0;
 }
 
 /* ====================================================================== */
 /**
- * @brief  Print the usage.
+ * @brief  "head -c && shift 1 byte" loop with spaced seeds.
  *
- * @param[in,out] out  Output stream.
+ * When more than one seed is given, each record is prefixed by its mask
+ * and a tab, and the records of one position are in the order of seeds.
+ *
+ * @param[in,out] in       Input file.
+ * @param[in,out] outs     Output streams (selected by the hash of each record).
+ * @param[in]     seeds    Spaced seeds.
+ * @param[in,out] encoder  Output encoding.
+ * @param[in,out] buf      Working buffer (history == the longest span - 1).
+ *
+ * @retval true   OK.
+ * @retval false  Read error.
  */
 /* ====================================================================== */
-void
-usage(std::ostream &out)
+bool
+hcasl_gapped(InputFile &in, const std::vector<std::ostream *> &outs, const std::vector<SpacedSeed> &seeds, WindowEncoder &encoder, WindowBuffer &buf)
 {
-	out << "usage: " << program_name << " [options] [file...]\n"
-	    << "    -n N\n"
-	    << "     print the N bytes per line (N >= 1)\n"
-	    << "    -o FILE\n"
-	    << "     place output in file FILE" << std::endl;
+	std::vector<char> record(buf.history() + 1 + GatherTable::SHUFFLE_SIZE);
+	const bool labeled = seeds.size() > 1;
+
+	return read_blocks(in, buf, [&] (const std::size_t n) {
+		const std::size_t size = buf.size();
+		const char * const block = buf.data();
+
+		for (std::size_t end = size - n + 1; end <= size; ++end) {
+			for (const auto &seed : seeds) {
+				if (end < seed.span()) {
+					continue;
+				}
+				seed.gather(block + end - seed.span(), record.data());
+				std::ostream &out = select_output(outs, record.data(), seed.weight());
+				if (labeled) {
+					out << seed.mask() << '\t';
+				}
+				encoder.write_record(out, record.data(), seed.weight());
+				out.put('\n');
+			}
+		}
+	});
 }
 
 /* ====================================================================== */
 /**
- * @brief  Print the version.
+ * @brief  Feed the hash of every N byte window into the distinct counters.
+ *
+ * @param[in,out] in        Input file.
+ * @param[in,out] counters  Distinct counters (one per window size).
+ * @param[in,out] buf       Working buffer (history == the largest window size).
+ *
+ * @retval true   OK.
+ * @retval false  Read error.
  */
 /* ====================================================================== */
-void
-version(void)
+bool
+distinct(InputFile &in, std::vector<DistinctCounter> &counters, WindowBuffer &buf)
 {
-	std::cout << program_name << " 1.0.0" << std::endl;
+	return read_blocks(in, buf, [&] (const std::size_t n) {
+		const std::size_t size = buf.size();
+		auto block = reinterpret_cast<const unsigned char *>(buf.data());
+
+		for (std::size_t i = size - n; i < size; ++i) {
+			for (auto &counter : counters) {
+				if (i >= counter.bytes) {
+					counter.hash.roll(block[i], block[i - counter.bytes]);
+				} else {
+					counter.hash.push(block[i]);
+				}
+				if (i + 1 >= counter.bytes) {
+					counter.sketch.add(counter.hash.value());
+				}
+			}
+		}
+	});
 }
 
 /* ====================================================================== */
 /**
- * @brief  "head -c && shift 1 byte" loop.
+ * @brief  Read the whole input.
  *
- * @param[in,out] in     Input stream.
- * @param[in,out] out    Output stream.
- * @param[in]     bytes  `head -c <bytes>`.
- * @param[in,out] buf    Working buffer.
+ * @param[in,out] in    Input file.
+ * @param[out]    data  Input data.
+ *
+ * @retval true   OK.
+ * @retval false  Read error.
  */
 /* ====================================================================== */
-void
-hcasl(std::istream &in, std::ostream &out, const unsigned long bytes, std::deque<char> &buf)
+bool
+read_all(InputFile &in, std::string &data)
 {
-	int c;
+	WindowBuffer buf(0);
 
-	while ((c = in.get()) != std::char_traits<char>::eof()) {
-		buf.push_back(static_cast<char>(static_cast<unsigned char>(c)));
-		if (buf.size() >= bytes) {
-			std::for_each(buf.cbegin(), buf.cend(), [&out] (const char c) {
-				out << c;
-			});
-			out << std::endl;
-			buf.pop_front();
+	return read_blocks(in, buf, [&] (const std::size_t n) {
+		data.append(buf.data(), n);
+	});
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Read saved sketches and merge them into sketches.
+ *
+ * @param[in,out] in        Input stream.
+ * @param[in,out] sketches  Merged sketches (one per window size).
+ *
+ * @retval true   OK.
+ * @retval false  Broken or incompatible sketch.
+ */
+/* ====================================================================== */
+bool
+merge_sketches(std::istream &in, std::vector<HyperLogLog> &sketches)
+{
+	std::vector<HyperLogLog> loaded;
+
+	try {
+		while (HyperLogLog::load(in, loaded)) {
+		}
+	} catch (const std::runtime_error &e) {
+		std::cerr << program_name << ": " << e.what() << std::endl;
+		return false;
+	}
+
+	for (auto &sketch : loaded) {
+		auto it = std::find_if(sketches.begin(), sketches.end(), [&sketch] (const HyperLogLog &s) {
+			return s.bytes() == sketch.bytes();
+		});
+		if (it == sketches.end()) {
+			sketches.push_back(std::move(sketch));
+		} else if (!it->merge(sketch)) {
+			std::cerr << program_name << ": sketch precision mismatch (N = " << sketch.bytes() << ")" << std::endl;
+			return false;
 		}
 	}
+	return true;
 }
 
 } // namespace
@@ -197,6 +2268,7 @@ main(int argc, char *argv[])
 	using std::string;
 
 	program_name = my_basename(argv[0]);
+	(void) select_kernel("auto");
 
 #if defined(_WIN32) || defined(_WIN64)
 	errno = 0;
@@ -211,12 +2283,65 @@ main(int argc, char *argv[])
 	}
 #endif /* defined(_WIN32) || defined(_WIN64) */
 
-	unsigned long bytes = 8;
+	enum {
+		OPT_DISTINCT = 0x100,
+		OPT_PRECISION,
+		OPT_SAVE_SKETCH,
+		OPT_MERGE,
+		OPT_MASK,
+		OPT_BASE64,
+		OPT_FLUSH_AFTER,
+		OPT_PARTITION,
+		OPT_COLLAPSE,
+		OPT_KERNEL,
+		OPT_RING,
+		OPT_SAMPLE_RATE,
+		OPT_RESERVOIR,
+		OPT_SEED,
+	};
+	static const struct option long_options[] = {
+		{ "distinct",    no_argument,       NULL, OPT_DISTINCT },
+		{ "precision",   required_argument, NULL, OPT_PRECISION },
+		{ "save-sketch", required_argument, NULL, OPT_SAVE_SKETCH },
+		{ "merge",       no_argument,       NULL, OPT_MERGE },
+		{ "mask",        required_argument, NULL, OPT_MASK },
+		{ "hex",         no_argument,       NULL, 'x' },
+		{ "follow",      no_argument,       NULL, 'f' },
+		{ "flush-after", required_argument, NULL, OPT_FLUSH_AFTER },
+		{ "partition",   required_argument, NULL, OPT_PARTITION },
+		{ "collapse",    no_argument,       NULL, OPT_COLLAPSE },
+		{ "kernel",      required_argument, NULL, OPT_KERNEL },
+		{ "ring",        required_argument, NULL, OPT_RING },
+		{ "sample-rate", required_argument, NULL, OPT_SAMPLE_RATE },
+		{ "reservoir",   required_argument, NULL, OPT_RESERVOIR },
+		{ "seed",        required_argument, NULL, OPT_SEED },
+		{ "base64",      no_argument,       NULL, OPT_BASE64 },
+		{ NULL,          0,                 NULL, 0 }
+	};
+
+	std::vector<unsigned long> bytes_list;
 	string output  = "-";
+	bool distinct_mode = false;
+	bool merge_mode = false;
+	unsigned int precision = 14;
+	string sketch_output;
+	std::vector<SpacedSeed> seeds;
+	bool follow = false;
+	int flush_after = -1;
+	unsigned long partitions = 0;
+	bool collapse = false;
+	string ring_name;
+	double sample_rate = 0.0;
+	unsigned long reservoir_size = 0;
+	std::uint64_t seed = std::random_device()();
+	WindowEncoder::Encoding encoding = WindowEncoder::RAW;
 
 	int c;
-	while ((c = getopt(argc, argv, "hn:o:v")) != -1) {
+	while ((c = getopt_long(argc, argv, "fhn:o:vx", long_options, NULL)) != -1) {
 		switch (c) {
+		case 'f':
+			follow = true;
+			break;
 		case 'h':
 			usage(cout);
 			return EXIT_SUCCESS;
@@ -229,7 +2354,7 @@ main(int argc, char *argv[])
 					usage(cerr);
 					return EXIT_FAILURE;
 				}
-				bytes = static_cast<unsigned long>(n);
+				bytes_list.push_back(static_cast<unsigned long>(n));
 			}
 			break;
 		case 'o':
@@ -238,45 +2363,393 @@ main(int argc, char *argv[])
 		case 'v':
 			version();
 			return EXIT_SUCCESS;
+		case 'x':
+			encoding = WindowEncoder::HEX;
+			break;
+		case OPT_BASE64:
+			encoding = WindowEncoder::BASE64;
+			break;
+		case OPT_FLUSH_AFTER:
+			{
+				std::istringstream mbuf(optarg);
+				int ms;
+				mbuf >> ms;
+				if (!mbuf || (ms < 0)) {
+					usage(cerr);
+					return EXIT_FAILURE;
+				}
+				flush_after = ms;
+			}
+			break;
+		case OPT_PARTITION:
+			{
+				std::istringstream kbuf(optarg);
+				long k;
+				kbuf >> k;
+				if (!kbuf || (k <= 0) || (static_cast<unsigned long>(k) > MAX_PARTITIONS)) {
+					usage(cerr);
+					return EXIT_FAILURE;
+				}
+				partitions = static_cast<unsigned long>(k);
+			}
+			break;
+		case OPT_COLLAPSE:
+			collapse = true;
+			break;
+		case OPT_RING:
+			ring_name = optarg;
+			break;
+		case OPT_SAMPLE_RATE:
+			{
+				std::istringstream rbuf(optarg);
+				double rate;
+				rbuf >> rate;
+				if (!rbuf || !(rate > 0.0) || (rate > 1.0)) {
+					usage(cerr);
+					return EXIT_FAILURE;
+				}
+				sample_rate = rate;
+			}
+			break;
+		case OPT_RESERVOIR:
+			{
+				std::istringstream kbuf(optarg);
+				long k;
+				kbuf >> k;
+				if (!kbuf || (k <= 0)) {
+					usage(cerr);
+					return EXIT_FAILURE;
+				}
+				reservoir_size = static_cast<unsigned long>(k);
+			}
+			break;
+		case OPT_SEED:
+			{
+				std::istringstream sbuf(optarg);
+				std::uint64_t s;
+				sbuf >> s;
+				if (!sbuf) {
+					usage(cerr);
+					return EXIT_FAILURE;
+				}
+				seed = s;
+			}
+			break;
+		case OPT_KERNEL:
+			if (string(optarg) == "list") {
+				list_kernels(cout);
+				return EXIT_SUCCESS;
+			}
+			if (!select_kernel(optarg)) {
+				cerr << program_name << ": " << optarg << ": unknown or unsupported kernel" << endl;
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_DISTINCT:
+			distinct_mode = true;
+			break;
+		case OPT_PRECISION:
+			{
+				std::istringstream pbuf(optarg);
+				unsigned int p;
+				pbuf >> p;
+				if (!pbuf || (p < HyperLogLog::MIN_PRECISION) || (p > HyperLogLog::MAX_PRECISION)) {
+					usage(cerr);
+					return EXIT_FAILURE;
+				}
+				precision = p;
+			}
+			break;
+		case OPT_SAVE_SKETCH:
+			sketch_output = optarg;
+			break;
+		case OPT_MERGE:
+			distinct_mode = merge_mode = true;
+			break;
+		case OPT_MASK:
+			try {
+				seeds.emplace_back(optarg);
+			} catch (const std::invalid_argument &e) {
+				cerr << program_name << ": " << e.what() << endl;
+				usage(cerr);
+				return EXIT_FAILURE;
+			}
+			break;
 		default:
 			usage(cerr);
 			return EXIT_FAILURE;
 		}
 	}
 
+	if (bytes_list.empty()) {
+		bytes_list.push_back(8);
+	}
+	if (distinct_mode) {
+		std::sort(bytes_list.begin(), bytes_list.end());
+		bytes_list.erase(std::unique(bytes_list.begin(), bytes_list.end()), bytes_list.end());
+	}
+	if (distinct_mode && !seeds.empty()) {
+		cerr << program_name << ": --mask cannot be used with --distinct" << endl;
+		return EXIT_FAILURE;
+	}
+	if (distinct_mode && (encoding != WindowEncoder::RAW)) {
+		cerr << program_name << ": -x and --base64 cannot be used with --distinct" << endl;
+		return EXIT_FAILURE;
+	}
+	// A saved sketch stores N in 4 bytes.
+	if (!sketch_output.empty() &&
+	    std::any_of(bytes_list.cbegin(), bytes_list.cend(), [] (const unsigned long n) { return n > UINT32_MAX; })) {
+		cerr << program_name << ": --save-sketch needs N <= " << UINT32_MAX << endl;
+		return EXIT_FAILURE;
+	}
+	const bool sampling = (sample_rate > 0.0) || (reservoir_size > 0);
+	if ((sample_rate > 0.0) && (reservoir_size > 0)) {
+		cerr << program_name << ": --sample-rate cannot be used with --reservoir" << endl;
+		return EXIT_FAILURE;
+	}
+	if (sampling && (distinct_mode || !seeds.empty() || collapse)) {
+		cerr << program_name << ": --sample-rate and --reservoir cannot be used with --distinct, --mask or --collapse" << endl;
+		return EXIT_FAILURE;
+	}
+	if (collapse && (distinct_mode || !seeds.empty())) {
+		cerr << program_name << ": --collapse cannot be used with --distinct or --mask" << endl;
+		return EXIT_FAILURE;
+	}
+	if ((partitions > 0) && distinct_mode) {
+		cerr << program_name << ": --partition cannot be used with --distinct" << endl;
+		return EXIT_FAILURE;
+	}
+	if ((partitions > 0) && (output == "-")) {
+		cerr << program_name << ": --partition needs -o FILE" << endl;
+		return EXIT_FAILURE;
+	}
+	if (!ring_name.empty()) {
+#ifdef HCASL_RING
+		if (distinct_mode || !seeds.empty() || collapse || sampling || (partitions > 0) || (encoding != WindowEncoder::RAW)) {
+			cerr << program_name << ": --ring can only be used with -n, -f and --flush-after" << endl;
+			return EXIT_FAILURE;
+		}
+#else /* def HCASL_RING */
+		cerr << program_name << ": --ring is not supported on this platform" << endl;
+		return EXIT_FAILURE;
+#endif /* def HCASL_RING */
+	}
+	if (follow && (flush_after < 0)) {
+		flush_after = 100;
+	}
+	const unsigned long bytes = bytes_list.back();
+	std::size_t history = bytes - 1;
+	if (distinct_mode || collapse) {
+		history = bytes;
+	} else if (!seeds.empty()) {
+		history = std::max_element(seeds.cbegin(), seeds.cend(), [] (const SpacedSeed &a, const SpacedSeed &b) {
+			return a.span() < b.span();
+		})->span() - 1;
+	}
+
 	bool use_stdout = output == "-";
+	std::unique_ptr<std::ostream> stdout_stream;
 	std::ofstream fout;
-	if (!use_stdout) {
+	std::vector<std::unique_ptr<std::ostream>> partition_outs;
+	std::vector<std::ostream *> outs;
+	if (partitions > 0) {
+		for (unsigned long i = 0; i < partitions; ++i) {
+			std::ostringstream pbuf;
+			pbuf << output << '.' << i;
+			const string path = pbuf.str();
+#ifdef HCASL_THREADS
+			std::unique_ptr<std::ostream> pout;
+			const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+			if (fd != -1) {
+				try {
+					pout.reset(new ThreadedFileStream(fd));
+				} catch (const std::bad_alloc &) {
+					// pout stays empty (fd is closed).
+				} catch (const std::system_error &) {
+					// No more threads; pout stays empty (fd is closed).
+				}
+			}
+#else /* def HCASL_THREADS */
+			std::unique_ptr<std::ostream> pout(new std::ofstream(path, ios::binary));
+#endif /* def HCASL_THREADS */
+			if (!pout || !*pout) {
+				cerr << program_name << ": " << path << ": cannot open" << endl;
+				return EXIT_FAILURE;
+			}
+			partition_outs.push_back(std::move(pout));
+			outs.push_back(partition_outs.back().get());
+		}
+	} else if (use_stdout) {
+		stdout_stream.reset(new FileDescriptorStream(STDOUT_FILENO, output_buffer, sizeof(output_buffer)));
+	} else {
+		fout.rdbuf()->pubsetbuf(output_buffer, sizeof(output_buffer));
 		fout.open(output, ios::binary);
 		if (!fout) {
 			cerr << program_name << ": " << output << ": cannot open" << endl;
 			return EXIT_FAILURE;
 		}
 	}
-	std::ostream &out = use_stdout ? cout : fout;
+	std::ostream &out = use_stdout ? *stdout_stream : fout;
+	if (outs.empty()) {
+		outs.push_back(&out);
+	}
 
-	std::deque<char> buf;
+	WindowBuffer buf(history);
+#ifdef HCASL_RING
+	hcasl_ring::RingWriter ring;
+	if (!ring_name.empty()) {
+		// At most 16 MiB of records (unless one record is larger).
+		const std::uint64_t slots = std::max<std::uint64_t>(1, (UINT64_C(16) << 20) / bytes);
+		if ((bytes > UINT32_MAX) || !ring.create(ring_name, static_cast<std::uint32_t>(bytes), slots)) {
+			cerr << program_name << ": " << ring_name << ": cannot create ring" << endl;
+			return EXIT_FAILURE;
+		}
+	}
+#endif /* def HCASL_RING */
+	WindowEncoder encoder(encoding);
+	CollapseState collapse_state;
+	Random random(seed);
+	BernoulliSample bernoulli(sample_rate, random);
+	Reservoir reservoir(random);
+	if ((reservoir_size > 0) && !reservoir.allocate(reservoir_size, bytes)) {
+		cerr << program_name << ": --reservoir " << reservoir_size << ": too large for -n " << bytes << endl;
+		return EXIT_FAILURE;
+	}
+	std::vector<DistinctCounter> counters;
+	std::vector<HyperLogLog> sketches;
 	int retval = EXIT_SUCCESS;
 
-	if (optind >= argc) {
-		hcasl(cin, out, bytes, buf);
-	} else {
-		std::for_each(&argv[optind], &argv[argc], [&out, &retval, &bytes, &buf] (const char * const s) {
-			assert(s != NULL);
-			string arg = s;
-
-			if (arg == "-") {
-				hcasl(cin, out, bytes, buf);
-			} else {
-				std::ifstream fin(arg, ios::binary);
-				if (!fin) {
-					cerr << program_name << ": " << arg << ": cannot open" << endl;
-					retval = EXIT_FAILURE;
-					return;
-				}
-				hcasl(fin, out, bytes, buf);
+	if (distinct_mode && !merge_mode) {
+		std::for_each(bytes_list.cbegin(), bytes_list.cend(), [&counters, precision] (const unsigned long n) {
+			counters.emplace_back(n, precision);
+		});
+	}
+
+	auto process = [&] (InputFile &in, const string &name) -> bool {
+		if (merge_mode) {
+			string data;
+			if (!read_all(in, data)) {
+				cerr << program_name << ": " << name << ": cannot read" << endl;
+				return false;
+			}
+			std::istringstream in(data);
+			if (!merge_sketches(in, sketches)) {
+				cerr << program_name << ": " << name << ": cannot merge" << endl;
+				return false;
+			}
+			return true;
+		}
+
+		bool ok;
+		if (distinct_mode) {
+			ok = distinct(in, counters, buf);
+		} else if (!seeds.empty()) {
+			ok = hcasl_gapped(in, outs, seeds, encoder, buf);
+		} else if (collapse) {
+			ok = hcasl_collapse(in, outs, bytes, encoder, collapse_state, buf);
+		} else if (sample_rate > 0.0) {
+			ok = hcasl_sample(in, outs, bytes, encoder, bernoulli, buf);
+		} else if (reservoir_size > 0) {
+			ok = hcasl_reservoir(in, reservoir, buf);
+#ifdef HCASL_RING
+		} else if (ring.is_open()) {
+			ok = hcasl_to_ring(in, ring, bytes, buf);
+#endif /* def HCASL_RING */
+		} else {
+			ok = hcasl(in, outs, bytes, encoder, buf);
+		}
+		if (!ok) {
+			cerr << program_name << ": " << name << ": cannot read" << endl;
+		}
+		return ok;
+	};
+
+	std::vector<string> inputs(&argv[optind], &argv[argc]);
+	if (inputs.empty()) {
+		inputs.push_back("-");
+	}
+
+	bool ring_gone = false;
+	std::for_each(inputs.cbegin(), inputs.cend(), [&] (const string &arg) {
+		// Once an output has failed, the rest is not read (the error is reported below).
+		if (ring_gone || std::any_of(outs.cbegin(), outs.cend(), [] (const std::ostream * const o) { return !*o; })) {
+			return;
+		}
+		// Only the last input is followed, because it never ends.
+		InputFile in(arg, follow && (&arg == &inputs.back()));
+		if (!in.is_open()) {
+			cerr << program_name << ": " << arg << ": cannot open" << endl;
+			retval = EXIT_FAILURE;
+			return;
+		}
+		if (flush_after >= 0) {
+			in.on_idle(flush_after, [&outs] {
+				std::for_each(outs.cbegin(), outs.cend(), [] (std::ostream * const o) {
+					o->flush();
+				});
+			});
+		}
+		try {
+			if (!process(in, arg)) {
+				retval = EXIT_FAILURE;
 			}
+		} catch (const std::bad_alloc &) {
+			cerr << program_name << ": " << arg << ": cannot allocate memory" << endl;
+			retval = EXIT_FAILURE;
+		} catch (const std::runtime_error &e) {
+			// Thrown by RingWriter::write() only.
+			cerr << program_name << ": " << ring_name << ": " << e.what() << endl;
+			retval = EXIT_FAILURE;
+			ring_gone = true;
+		}
+	});
+
+	if (collapse) {
+		collapse_finish(outs, bytes, encoder, collapse_state, buf);
+	}
+	if (reservoir_size > 0) {
+		reservoir_finish(outs, encoder, reservoir);
+	}
+
+	// With a failed --merge, the sketches merged so far would give a wrong estimate.
+	if (distinct_mode && !(merge_mode && (retval != EXIT_SUCCESS))) {
+		std::for_each(counters.cbegin(), counters.cend(), [&sketches] (const DistinctCounter &counter) {
+			sketches.push_back(counter.sketch);
+		});
+		std::sort(sketches.begin(), sketches.end(), [] (const HyperLogLog &a, const HyperLogLog &b) {
+			return a.bytes() < b.bytes();
 		});
+
+		for (const auto &sketch : sketches) {
+			if (sketches.size() > 1) {
+				out << sketch.bytes() << '\t';
+			}
+			out << sketch.estimate() << endl;
+		}
+
+		if (!sketch_output.empty()) {
+			std::ofstream sout(sketch_output, ios::binary);
+			std::for_each(sketches.cbegin(), sketches.cend(), [&sout] (const HyperLogLog &sketch) {
+				sketch.save(sout);
+			});
+			if (!sout.flush()) {
+				cerr << program_name << ": " << sketch_output << ": cannot write" << endl;
+				retval = EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (partitions == 0) {
+		if (!out.flush()) {
+			cerr << program_name << ": " << (use_stdout ? "stdout" : output) << ": cannot write" << endl;
+			retval = EXIT_FAILURE;
+		}
+	}
+	for (unsigned long i = 0; i < partitions; ++i) {
+		if (!outs[i]->flush()) {
+			cerr << program_name << ": " << output << "." << i << ": cannot write" << endl;
+			retval = EXIT_FAILURE;
+		}
 	}
 
 	return retval;
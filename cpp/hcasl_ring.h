@@ -0,0 +1,387 @@
+/* ********************************************************************** */
+/**
+ * @brief   Shared-memory record ring of hcasl (--ring NAME).
+ * @author  eel3
+ * @date    2026/10/19
+ *
+ * A single-producer/single-consumer ring of fixed-size window records,
+ * placed in POSIX shared memory (/dev/shm/NAME on Linux). hcasl is the
+ * producer; a consumer process reads the records in place with
+ * RingReader, without a pipe and without parsing newlines.
+ *
+ * @code
+ * hcasl_ring::RingReader ring;
+ * if (!ring.open("name", true, 10000)) { ... }
+ * const char *records;
+ * std::size_t n;
+ * while ((n = ring.wait(&records)) > 0) {
+ *     // records[0 .. n * ring.record_size()) are n windows.
+ *     ring.consume(n);
+ * }
+ * if (ring.abandoned()) { ... }
+ * @endcode
+ *
+ * Each side stores its pid in the header, so that the other one does
+ * not wait forever for a dead process: RingWriter::write() throws
+ * std::runtime_error once the consumer has gone, and RingReader::wait()
+ * returns 0 (with abandoned() true) once the producer has gone.
+ *
+ * @par Compilers
+ * - GCC 12.2.0 on Debian 12
+ */
+/* ********************************************************************** */
+
+#ifndef HCASL_RING_H_INCLUDED
+#define HCASL_RING_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace hcasl_ring {
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the ring needs lock-free 64-bit atomics");
+
+/* ====================================================================== */
+/**
+ * @brief  Layout of the shared memory: this header, then the records.
+ *
+ * head and tail are free running record counters; slot i of the ring is
+ * at records + (i % capacity) * record_size.
+ */
+/* ====================================================================== */
+struct RingHeader {
+	static const std::uint32_t MAGIC = 0x474E5252;	// "RRNG"
+	static const std::uint32_t VERSION = 2;
+
+	std::atomic<std::uint32_t> magic;	// written last by the producer
+	std::uint32_t version;
+	std::uint32_t record_size;
+	std::uint32_t reserved;
+	std::uint64_t capacity;			// number of slots (power of 2)
+
+	alignas(64) std::atomic<std::uint64_t> head;	// written by the producer
+	alignas(64) std::atomic<std::uint64_t> tail;	// written by the consumer
+	alignas(64) std::atomic<std::uint32_t> closed;	// the producer has finished
+	std::atomic<std::int32_t> producer;		// pid of the producer
+	std::atomic<std::int32_t> consumer;		// pid of the consumer (0: not attached yet)
+};
+
+/** Offset of the first record. */
+const std::size_t RING_RECORDS_OFFSET = (sizeof(RingHeader) + 63) / 64 * 64;
+
+/** Returns the shm_open(3) name of a ring. */
+inline std::string
+ring_shm_name(const std::string &name)
+{
+	return (!name.empty() && (name[0] == '/')) ? name : "/" + name;
+}
+
+/** Back off while waiting for the other side. */
+inline void
+ring_backoff(unsigned int &spins)
+{
+	if (++spins < 64) {
+		std::this_thread::yield();
+	} else {
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+}
+
+/** Returns true if the process pid has exited (checked every 1024th spin, about 0.1 s). */
+inline bool
+ring_peer_gone(const std::int32_t pid, const unsigned int spins)
+{
+	return (pid > 0) && (spins % 1024 == 0) && (kill(static_cast<pid_t>(pid), 0) == -1) && (errno == ESRCH);
+}
+
+/* ====================================================================== */
+/**
+ * @brief  Mapping of a ring (common part of the producer and the consumer).
+ */
+/* ====================================================================== */
+class RingMapping {
+public:
+	RingMapping() : m_addr(NULL), m_size(0) {}
+
+	~RingMapping()
+	{
+		if (m_addr != NULL) {
+			(void) munmap(m_addr, m_size);
+		}
+	}
+
+	RingMapping(const RingMapping &) = delete;
+	RingMapping &operator=(const RingMapping &) = delete;
+
+	bool is_open() const { return m_addr != NULL; }
+	std::uint32_t record_size() const { return header()->record_size; }
+	std::uint64_t capacity() const { return header()->capacity; }
+
+protected:
+	RingHeader *header() const { return static_cast<RingHeader *>(m_addr); }
+
+	char *slot(const std::uint64_t i) const
+	{
+		return static_cast<char *>(m_addr) + RING_RECORDS_OFFSET +
+		       static_cast<std::size_t>(i & (header()->capacity - 1)) * header()->record_size;
+	}
+
+	bool map(const int fd, const std::size_t size)
+	{
+		void * const addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		(void) ::close(fd);
+		if (addr == MAP_FAILED) {
+			return false;
+		}
+		m_addr = addr;
+		m_size = size;
+		return true;
+	}
+
+private:
+	void *m_addr;
+	std::size_t m_size;
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Producer side of a ring.
+ */
+/* ====================================================================== */
+class RingWriter : public RingMapping {
+public:
+	RingWriter() : m_head(0), m_tail(0) {}
+
+	~RingWriter()
+	{
+		close();
+	}
+
+	/**
+	 * Create (or replace) the ring. capacity is rounded down to a power
+	 * of 2 (at least 1 slot). The memory is allocated here, so a full
+	 * /dev/shm makes this fail instead of raising SIGBUS in write().
+	 */
+	bool create(const std::string &name, const std::uint32_t record_size, const std::uint64_t capacity)
+	{
+		std::uint64_t slots = 1;
+		while ((slots << 1) <= capacity) {
+			slots <<= 1;
+		}
+		const std::size_t size = RING_RECORDS_OFFSET + static_cast<std::size_t>(slots) * record_size;
+		const std::string shm_name = ring_shm_name(name);
+
+		(void) shm_unlink(shm_name.c_str());
+		const int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd == -1) {
+			return false;
+		}
+		if (!allocate(fd, size)) {
+			(void) ::close(fd);
+			(void) shm_unlink(shm_name.c_str());
+			return false;
+		}
+		if (!map(fd, size)) {
+			(void) shm_unlink(shm_name.c_str());
+			return false;
+		}
+
+		RingHeader * const h = header();
+		h->version = RingHeader::VERSION;
+		h->record_size = record_size;
+		h->reserved = 0;
+		h->capacity = slots;
+		h->head.store(0, std::memory_order_relaxed);
+		h->tail.store(0, std::memory_order_relaxed);
+		h->closed.store(0, std::memory_order_relaxed);
+		h->producer.store(static_cast<std::int32_t>(getpid()), std::memory_order_relaxed);
+		h->consumer.store(0, std::memory_order_relaxed);
+		h->magic.store(RingHeader::MAGIC, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Copy a record (record_size bytes) to the ring; waits while the ring
+	 * is full. Throws std::runtime_error if the consumer has gone.
+	 */
+	void write(const char * const record)
+	{
+		RingHeader * const h = header();
+
+		if (m_head - m_tail == h->capacity) {
+			publish();
+			unsigned int spins = 0;
+			while ((m_tail = h->tail.load(std::memory_order_acquire)) + h->capacity == m_head) {
+				ring_backoff(spins);
+				if (ring_peer_gone(h->consumer.load(std::memory_order_acquire), spins)) {
+					throw std::runtime_error("the consumer of the ring has gone");
+				}
+			}
+		}
+		std::memcpy(slot(m_head), record, h->record_size);
+		++m_head;
+	}
+
+	/** Make the written records visible to the consumer. */
+	void publish()
+	{
+		if (is_open()) {
+			header()->head.store(m_head, std::memory_order_release);
+		}
+	}
+
+	/** Publish the rest and tell the consumer that no more records come. */
+	void close()
+	{
+		if (is_open()) {
+			publish();
+			header()->closed.store(1, std::memory_order_release);
+		}
+	}
+
+private:
+	static bool allocate(const int fd, const std::size_t size)
+	{
+		if (ftruncate(fd, static_cast<off_t>(size)) == -1) {
+			return false;
+		}
+#ifdef __linux__
+		// ftruncate(2) on tmpfs reserves nothing; the pages are taken on first touch.
+		if (posix_fallocate(fd, 0, static_cast<off_t>(size)) != 0) {
+			return false;
+		}
+#endif /* def __linux__ */
+		return true;
+	}
+
+	std::uint64_t m_head;	// local copy (not published yet)
+	std::uint64_t m_tail;	// cached consumer position
+};
+
+/* ====================================================================== */
+/**
+ * @brief  Consumer side of a ring.
+ */
+/* ====================================================================== */
+class RingReader : public RingMapping {
+public:
+	RingReader() : m_tail(0), m_abandoned(false) {}
+
+	/**
+	 * Open the ring created by the producer; waits until it appears, but
+	 * at most timeout_ms milliseconds. With remove, the name is unlinked
+	 * once opened (the memory stays until both sides unmap it).
+	 */
+	bool open(const std::string &name, const bool remove, const unsigned long timeout_ms)
+	{
+		const std::string shm_name = ring_shm_name(name);
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+		unsigned int spins = 0;
+		int fd;
+		struct stat st;
+
+		for (;;) {
+			fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+			if ((fd != -1) && (fstat(fd, &st) == 0) &&
+			    (static_cast<std::size_t>(st.st_size) >= RING_RECORDS_OFFSET)) {
+				break;
+			}
+			if (fd != -1) {
+				(void) ::close(fd);
+			}
+			if (std::chrono::steady_clock::now() >= deadline) {
+				return false;
+			}
+			ring_backoff(spins);
+		}
+		if (!map(fd, static_cast<std::size_t>(st.st_size))) {
+			return false;
+		}
+		while (header()->magic.load(std::memory_order_acquire) != RingHeader::MAGIC) {
+			if (std::chrono::steady_clock::now() >= deadline) {
+				return false;
+			}
+			ring_backoff(spins);
+		}
+		if (header()->version != RingHeader::VERSION) {
+			return false;
+		}
+		if (remove) {
+			(void) shm_unlink(shm_name.c_str());
+		}
+		header()->consumer.store(static_cast<std::int32_t>(getpid()), std::memory_order_release);
+		m_tail = header()->tail.load(std::memory_order_relaxed);
+		return true;
+	}
+
+	/** Returns true if the producer has exited without closing the ring. */
+	bool abandoned() const { return m_abandoned; }
+
+	/**
+	 * Returns the number of records that can be read in place at *records
+	 * (contiguous, so it may be less than all available ones); 0 if none.
+	 */
+	std::size_t peek(const char ** const records) const
+	{
+		const RingHeader * const h = header();
+		const std::uint64_t head = h->head.load(std::memory_order_acquire);
+		const std::uint64_t contiguous = h->capacity - (m_tail & (h->capacity - 1));
+		const std::uint64_t n = std::min(head - m_tail, contiguous);
+
+		*records = slot(m_tail);
+		return static_cast<std::size_t>(n);
+	}
+
+	/**
+	 * Like peek(), but waits for records; returns 0 when the producer has
+	 * finished or has gone (see abandoned()).
+	 */
+	std::size_t wait(const char ** const records)
+	{
+		unsigned int spins = 0;
+
+		for (;;) {
+			const bool closed = header()->closed.load(std::memory_order_acquire) != 0;
+			const std::size_t n = peek(records);
+			if ((n > 0) || closed) {
+				return n;
+			}
+			ring_backoff(spins);
+			if (ring_peer_gone(header()->producer.load(std::memory_order_relaxed), spins)) {
+				// Records published before the exit are still read.
+				const std::size_t rest = peek(records);
+				m_abandoned = rest == 0;
+				return rest;
+			}
+		}
+	}
+
+	/** Release n records returned by peek() or wait(). */
+	void consume(const std::size_t n)
+	{
+		m_tail += n;
+		header()->tail.store(m_tail, std::memory_order_release);
+	}
+
+private:
+	std::uint64_t m_tail;
+	bool m_abandoned;
+};
+
+} // namespace hcasl_ring
+
+#endif /* ndef HCASL_RING_H_INCLUDED */